@@ -21,14 +21,19 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
 #include <glib.h>
 #ifndef _WIN32
-#include <expat.h>
+#include <unistd.h>
 #else
-#include "xmlparse.h"
+#include <io.h>
 #endif
 #include "stack.h"
 #include "xmlrpc.h"
+#include "xmlrpc_private.h"
 #include "debug.h"
 
 /* 1 - Debugging On  0 - Debugging Off */
@@ -40,26 +45,6 @@
 #define xmlrpc_debug(msg, args...)
 #endif
 
-typedef enum _parse_state {
-	MethodResponse = 0,
-	Params,
-	Param,
-	Value,
-	Integer,
-	Boolean,
-	String,
-	Double,
-	DateTime_iso8601,
-	Base64,
-	Struct,
-	Member,
-	Name,
-	Array,
-	Data,
-	Fault,
-	Unknown
-} parse_state;
-
 typedef enum _parse_event {
 	start_element,
 	end_element,
@@ -67,9 +52,37 @@ typedef enum _parse_event {
 } parse_event;
 
 struct state_data {
-	int error;
+	int error;	/* xmlrpc_parse_status of the first error */
+	XML_Parser p;
 	struct _stack *tag_stack;
 	struct xmlrpc_response *response;
+	/* Character data of an untyped <value>. It is only committed to the
+	   value at </value>, and dropped as soon as a child tag shows up, so
+	   whitespace between structural tags never gets its own allocation. */
+	GString *value_chars;
+	int value_chars_pending;
+	struct xmlrpc_parse_options opts;
+	/* Decoder for the <base64> value currently being spilled to a file */
+	struct base64_spill *spill;
+	int spill_declined;
+	struct xmlrpc_parse_stats stats;
+	unsigned int depth;
+	GTimer *timer;
+};
+
+struct base64_spill {
+	struct xmlrpc_base64_file *file;
+	off_t start;		/* fd offset the decoded data begins at */
+	guint32 quad;		/* 6 bit groups collected so far */
+	int nquad;
+	int pad;		/* number of '=' seen */
+	int out_len;
+	guchar out[4096];
+};
+
+struct xmlrpc_parser {
+	XML_Parser p;
+	struct state_data *sd;
 };
 
 struct xmlrpc_tag {
@@ -82,7 +95,11 @@ struct xmlrpc_tag {
  *  PRIVATE CODE
  */
 
-static void xmlrpc_parse_error(struct state_data *sd, const char *fmt, ...) {
+/* Process wide totals, merged in as each parse finishes */
+static struct xmlrpc_parse_stats global_stats;
+G_LOCK_DEFINE_STATIC(global_stats);
+
+static void xmlrpc_parse_error(struct state_data *sd, xmlrpc_parse_status status, const char *fmt, ...) {
 	va_list ap;
 	gchar *s;
 
@@ -90,12 +107,47 @@ static void xmlrpc_parse_error(struct state_data *sd, const char *fmt, ...) {
 	s = g_strdup_vprintf(fmt, ap);
 	va_end(ap);
 
-	sd->error = 1;
+	if(!sd->error) {
+		sd->error = status;
+#ifdef HAVE_XML_STOPPARSER
+		/* No point in having expat go through the rest */
+		XML_StopParser(sd->p, XML_FALSE);
+#endif
+	}
 	xmlrpc_debug("xmlrpc parse error: %s\n", s);
 	g_free(s);
 }
 
-static parse_state get_parse_state(const char* tag) {
+static void check_alloc_limit(struct state_data *sd) {
+	if(sd->opts.max_alloc_bytes && sd->stats.alloc_bytes > sd->opts.max_alloc_bytes)
+		xmlrpc_parse_error(sd, xmlrpc_parse_limit_memory, "More than %lu bytes allocated\n",
+				   sd->opts.max_alloc_bytes);
+}
+
+/* All allocations for the response tree go through here so they're
+   counted */
+static void *parse_alloc(struct state_data *sd, gsize size) {
+	sd->stats.allocs++;
+	sd->stats.alloc_bytes += size;
+	/* The caller still gets its memory; the parse ends after this event */
+	check_alloc_limit(sd);
+	return g_malloc0(size);
+}
+
+static void *parse_memdup(struct state_data *sd, gconstpointer mem, gsize size) {
+	void *ret = parse_alloc(sd, size);
+
+	memcpy(ret, mem, size);
+	return ret;
+}
+
+#define parse_new0(sd, type) ((type*)parse_alloc(sd, sizeof(type)))
+
+static int base64_spill_start(struct state_data *sd, struct xmlrpc_value *value, int namelen);
+static int base64_spill_chars(struct state_data *sd, const char *txt, int len);
+static int base64_spill_finish(struct state_data *sd);
+
+parse_state xmlrpc_get_parse_state(const char* tag) {
 	parse_state ret;
 
 	if(strcmp("methodResponse", tag)==0)
@@ -137,8 +189,45 @@ static parse_state get_parse_state(const char* tag) {
 	return ret;
 }
 
-static struct xmlrpc_tag *new_tag(parse_state name) {
-	struct xmlrpc_tag *tag = g_new0(struct xmlrpc_tag, 1);
+int xmlrpc_parse_state_type(parse_state state, xmlrpc_type *type) {
+	switch(state) {
+	case Integer:
+		*type = Integer_T;
+		break;
+	case Boolean:
+		*type = Boolean_T;
+		break;
+	case String:
+		*type = String_T;
+		break;
+	case Double:
+		*type = Double_T;
+		break;
+	case DateTime_iso8601:
+		*type = DateTime_iso8601_T;
+		break;
+	case Base64:
+		*type = Base64_T;
+		break;
+	case Struct:
+		*type = Struct_T;
+		break;
+	case Array:
+		*type = Array_T;
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static struct xmlrpc_tag *new_tag(struct state_data *sd, parse_state name) {
+	struct xmlrpc_tag *tag;
+
+	if(name == Unknown)
+		return NULL;
+	/* Parser scratch, freed at the close tag, so not counted */
+	tag = g_new0(struct xmlrpc_tag, 1);
 
 	if(!tag)
 		return NULL;
@@ -146,33 +235,29 @@ static struct xmlrpc_tag *new_tag(parse_state name) {
 	tag->name = name;
 
 	switch(name) {
-	case Unknown: {
-		g_free(tag);
-		return NULL;
-	}
 	case Param:
-		tag->data = g_new0(struct xmlrpc_param, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_param);
 		break;
 	case Value:
-		tag->data = g_new0(struct xmlrpc_value, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_value);
 		break;
 	case Member:
-		tag->data = g_new0(struct xmlrpc_struct_member, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_struct_member);
 		break;
 	case MethodResponse:
-		tag->data = g_new0(struct xmlrpc_response, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_response);
 		break;
 	case Array:
-		tag->data = g_new0(struct xmlrpc_array, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_array);
 		break;
 	case Data:
-		tag->data = g_new0(struct xmlrpc_data, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_data);
 		break;
 	case Struct:
-		tag->data = g_new0(struct xmlrpc_struct, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_struct);
 		break;
 	case Fault:
-		tag->data = g_new0(struct xmlrpc_fault, 1);
+		tag->data = parse_new0(sd, struct xmlrpc_fault);
 		break;
 	case Params:
 	case Name:
@@ -193,7 +278,15 @@ static struct xmlrpc_tag *new_tag(parse_state name) {
 #define CHECK_POINTER( pointer ) \
 { \
 	if(!pointer) { \
-		xmlrpc_parse_error(sd, "Received unexpected NULL pointer\n"); \
+		xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "Received unexpected NULL pointer\n"); \
+		return; \
+	} \
+}
+
+#define CHECK_STRING_LEN( len ) \
+{ \
+	if(sd->opts.max_string_len && (unsigned long)(len) > sd->opts.max_string_len) { \
+		xmlrpc_parse_error(sd, xmlrpc_parse_limit_string, "String longer than %lu bytes\n", sd->opts.max_string_len); \
 		return; \
 	} \
 }
@@ -201,7 +294,7 @@ static struct xmlrpc_tag *new_tag(parse_state name) {
 #define CHECK_TAG( tag, value ) \
 { \
 	if(tag != value) { \
-		xmlrpc_parse_error(sd, "Expected <%s> prior to current tag\n", value); \
+		xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "Expected <%s> prior to current tag\n", value); \
 		return; \
 	} \
 }
@@ -218,15 +311,26 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 	/* convert tag string to enum type */
 	if(event == start_element ||
 	   event == end_element)
-		state = get_parse_state(name);
+		state = xmlrpc_get_parse_state(name);
 
 	switch(event) {
 	case start_element:
 		xmlrpc_debug("Open tag: %s\n", name);
+		sd->stats.elements++;
+		if(++sd->depth > sd->stats.max_depth)
+			sd->stats.max_depth = sd->depth;
+		if(sd->opts.max_elements && sd->stats.elements > sd->opts.max_elements) {
+			xmlrpc_parse_error(sd, xmlrpc_parse_limit_elements, "More than %lu elements\n", sd->opts.max_elements);
+			return;
+		}
+		if(sd->opts.max_depth && sd->depth > sd->opts.max_depth) {
+			xmlrpc_parse_error(sd, xmlrpc_parse_limit_depth, "Nested deeper than %u\n", sd->opts.max_depth);
+			return;
+		}
 
 		switch(state) {
 		case MethodResponse: {
-			tag = new_tag(MethodResponse);
+			tag = new_tag(sd, MethodResponse);
 			CHECK_POINTER(tag);
 			sd->response = XMLRPC_RESPONSE(tag->data);
 			stack_push(sd->tag_stack, tag);
@@ -239,7 +343,7 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			CHECK_TAG(tag->name, MethodResponse);
 			CHECK_POINTER(sd->response);
 			sd->response->type = fault;
-			tag = new_tag(Fault);
+			tag = new_tag(sd, Fault);
 			CHECK_POINTER(tag);
 			sd->response->data = tag->data;
 			stack_push(sd->tag_stack, tag);
@@ -251,7 +355,7 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			CHECK_TAG(tag->name, MethodResponse);
 			CHECK_POINTER(sd->response);
 			sd->response->type = valid;
-			tag = new_tag(Params);
+			tag = new_tag(sd, Params);
 			CHECK_POINTER(tag);
 			stack_push(sd->tag_stack, tag);
 			CHECK_POINTER(sd->tag_stack);
@@ -264,10 +368,10 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			CHECK_POINTER(sd->response);
 			/* params only allowed one param */
 			if(sd->response->data) {
-				xmlrpc_parse_error(sd, "<params> may only contain one <param> tag\n");
+				xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "<params> may only contain one <param> tag\n");
 				return;
 			}
-			tag = new_tag(Param);
+			tag = new_tag(sd, Param);
 			CHECK_POINTER(tag);
 			sd->response->data = tag->data;
 			stack_push(sd->tag_stack, tag);
@@ -284,10 +388,10 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 				param = XMLRPC_PARAM(tag->data);
 				/* We're only allowed one param value */
 				if(param->value) {
-					xmlrpc_parse_error(sd, "<param> may only contain one <value> tag\n");
+					xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "<param> may only contain one <value> tag\n");
 					return;
 				}
-				tag = new_tag(Value);
+				tag = new_tag(sd, Value);
 				CHECK_POINTER(tag);
 				param->value = XMLRPC_VALUE(tag->data);
 				stack_push(sd->tag_stack, tag);
@@ -301,11 +405,11 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 				if(data->value) {
 					while(data->next)
 						data = data->next;
-					data->next = g_new0(struct xmlrpc_data, 1);
+					data->next = parse_new0(sd, struct xmlrpc_data);
 					CHECK_POINTER(data->next);
 					data = data->next;
 				}
-				tag = new_tag(Value);
+				tag = new_tag(sd, Value);
 				CHECK_POINTER(tag);
 				data->value = XMLRPC_VALUE(tag->data);
 				stack_push(sd->tag_stack, tag);
@@ -315,7 +419,7 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 
 				CHECK_POINTER(tag->data);
 				member = XMLRPC_STRUCT_MEMBER(tag->data);
-				tag = new_tag(Value);
+				tag = new_tag(sd, Value);
 				CHECK_POINTER(tag);
 				member->value = XMLRPC_VALUE(tag->data);
 				stack_push(sd->tag_stack, tag);
@@ -324,15 +428,18 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 				struct xmlrpc_fault *fault;
 				CHECK_POINTER(tag->data);
 				fault = XMLRPC_FAULT(tag->data);
-				tag = new_tag(Value);
+				tag = new_tag(sd, Value);
 				CHECK_POINTER(tag);
 				fault->value = XMLRPC_VALUE(tag->data);
 				stack_push(sd->tag_stack, tag);
 			}
 			else {
-				xmlrpc_parse_error(sd, "Expected <param>, <data>, <member> or <fault> prior to <value> tag\n");
+				xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "Expected <param>, <data>, <member> or <fault> prior to <value> tag\n");
 				return;
 			}
+			/* Until a type tag shows up, this is a string value */
+			g_string_truncate(sd->value_chars, 0);
+			sd->value_chars_pending = 1;
 			break;
 		}
 		case Data: {
@@ -344,7 +451,7 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 
 				CHECK_POINTER(tag->data);
 				array = XMLRPC_ARRAY(tag->data);
-				tag = new_tag(Data);
+				tag = new_tag(sd, Data);
 				CHECK_POINTER(tag);
 				array->data = XMLRPC_DATA(tag->data);
 			}
@@ -360,17 +467,11 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			CHECK_TAG(tag->name, Value);
 			CHECK_POINTER(tag->data);
 			value = XMLRPC_VALUE(tag->data);
-			tag = new_tag(state);
+			tag = new_tag(sd, state);
 			CHECK_POINTER(tag);
-			/* Make sure to free char data that may have been set
-			   after the value tag. This will happen because a
-			   value without specific type tags defaults to the
-			   string type */
-			if(value->data && (value->type == String_T)) {
-				xmlrpc_debug("Free bogus char element\n");
-				g_free(value->data);
-				value->data_len = 0;
-			}
+			/* Char data seen so far was only whitespace around the
+			   container, drop it */
+			sd->value_chars_pending = 0;
 			value->type = (state == Array) ? Array_T : Struct_T;
 			value->data = tag->data;
 			stack_push(sd->tag_stack, tag);
@@ -388,11 +489,11 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			if(sTruct->member) {
 				while(sTruct->next)
 					sTruct = sTruct->next;
-				sTruct->next = g_new0(struct xmlrpc_struct, 1);
+				sTruct->next = parse_new0(sd, struct xmlrpc_struct);
 				CHECK_POINTER(sTruct->next);
 				sTruct = sTruct->next;
 			}
-			tag = new_tag(Member);
+			tag = new_tag(sd, Member);
 			CHECK_POINTER(tag);
 			sTruct->member = XMLRPC_STRUCT_MEMBER(tag->data);
 			stack_push(sd->tag_stack, tag);
@@ -405,7 +506,7 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			CHECK_TAG(tag->name, Member);
 			CHECK_POINTER(tag->data);
 			member = tag->data;
-			tag = new_tag(Name);
+			tag = new_tag(sd, Name);
 			CHECK_POINTER(tag);
 			/* Pass member struct to name tag */
 			tag->data = member;
@@ -425,17 +526,16 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 			tag = XMLRPC_TAG(stack_top(sd->tag_stack));
 			CHECK_POINTER(tag);
 			CHECK_TAG(tag->name, Value);
+			CHECK_POINTER(tag->data);
 			value = XMLRPC_VALUE(tag->data);
-			tag = new_tag(state);
-			/* Make sure to free char data that may have been set
-			   after the value tag. This will happen because a
-			   value without specific type tags defaults to the
-			   string type */
-			if(value->data && (value->type == String_T)) {
-				xmlrpc_debug("Free bogus char element\n");
-				g_free(value->data);
-				value->data_len = 0;
-			}
+			tag = new_tag(sd, state);
+			CHECK_POINTER(tag);
+			/* The value has a type tag, so any char data seen
+			   after <value> was not a string */
+			sd->value_chars_pending = 0;
+			sd->spill_declined = 0;
+			/* Set here, an empty element never gets char data */
+			xmlrpc_parse_state_type(state, &value->type);
 			/* Pass value struct to simple value type tag */
 			tag->data = (void*)value;
 			stack_push(sd->tag_stack, tag);
@@ -444,13 +544,14 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 		case Unknown:
 		default:
 		{
-			xmlrpc_parse_error(sd, "Unknown xmlrpc open tag: %s\n", name);
+			xmlrpc_parse_error(sd, xmlrpc_parse_unknown_tag, "Unknown xmlrpc open tag: %s\n", name);
 			return;
 		}
 		}/*end switch*/
 		break;
 	case end_element:
 		xmlrpc_debug("Close tag: %s\n", name);
+		sd->depth--;
 
 		tag = XMLRPC_TAG(stack_pop(sd->tag_stack));
 		CHECK_POINTER(tag);
@@ -458,9 +559,33 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 		if(tag->name != state) {
 			/* We're not likely to get here since the xml parser should
 			   catch this first. */
-			xmlrpc_parse_error(sd, "Close tag %s, does not match the open tag on the stack\n", name);
+			xmlrpc_parse_error(sd, xmlrpc_parse_bad_structure, "Close tag %s, does not match the open tag on the stack\n", name);
 			return;
 		}
+		if(tag->name == Base64 && sd->spill) {
+			g_free(tag);
+			if(base64_spill_finish(sd) < 0)
+				xmlrpc_parse_error(sd, xmlrpc_parse_bad_data, "Couldn't write decoded base64 data\n");
+			return;
+		}
+		/* Value without specific type tags defaults to the string type */
+		if(tag->name == Value && sd->value_chars_pending) {
+			struct xmlrpc_value *value = XMLRPC_VALUE(tag->data);
+
+			value->type = String_T;
+			value->data = parse_memdup(sd, sd->value_chars->str, sd->value_chars->len+1);
+			value->data_len = sd->value_chars->len;
+			sd->value_chars_pending = 0;
+		}
+		/* <string></string> is an empty string, same as <value></value> */
+		if(tag->name == String && !XMLRPC_VALUE(tag->data)->data) {
+			struct xmlrpc_value *value = XMLRPC_VALUE(tag->data);
+
+			value->data = parse_memdup(sd, "", 1);
+			value->data_len = 0;
+		}
+		if(tag->name == Value && XMLRPC_VALUE(tag->data)->type < XMLRPC_TYPE_COUNT)
+			sd->stats.values[XMLRPC_VALUE(tag->data)->type]++;
 		g_free(tag);
 		break;
 	case char_element:
@@ -473,59 +598,66 @@ static void state_machine(parse_event event, void *userdata, const char *name, i
 		case Double:
 		case Integer:
 		case DateTime_iso8601:
-		case Base64: 
-		case Value: {
+		case Base64: {
 			struct xmlrpc_value *value;
 
 			CHECK_POINTER(tag->data);
 			value = XMLRPC_VALUE(tag->data);
-			/* set value type */
-			if(tag->name == Boolean)
-				value->type = Boolean_T;
-			else if(tag->name == String)
-				value->type = String_T;
-			else if(tag->name == Double)
-				value->type = Double_T;
-			else if(tag->name == Integer)
-				value->type = Integer_T;
-			else if(tag->name == DateTime_iso8601)
-				value->type = DateTime_iso8601_T;
-			else if(tag->name == Base64)
-				value->type = Base64_T;
-			/* Value with no type is automatically a string */
-			else if(tag->name == Value)
-				value->type = String_T;
-
-			/* set value data - If data chunk already exists.. append to it.
-			   It could be that data is already set for non scalar types
-			   (e.g struct or array).. We'll recongnize those cases because
-			   the data_len should be set to 0. */
+			/* Large base64 values get decoded straight to a file */
+			if(tag->name == Base64 && (sd->spill || base64_spill_start(sd, value, namelen))) {
+				if(base64_spill_chars(sd, name, namelen) < 0)
+					xmlrpc_parse_error(sd, xmlrpc_parse_bad_data, "Bad base64 data or write error\n");
+				break;
+			}
+			/* set value data - If data chunk already exists.. append to it. */
+			CHECK_STRING_LEN(value->data_len + namelen);
 			if(value->data && (value->data_len > 0)) {
 				value->data = g_realloc(value->data, value->data_len + namelen + 1);
+				sd->stats.allocs++;
+				sd->stats.alloc_bytes += namelen;
+				check_alloc_limit(sd);
 				memcpy(((value->data)+(value->data_len)), name, namelen);
 				value->data_len = value->data_len + namelen;
 				((char*)(value->data))[value->data_len] = '\0';
 				xmlrpc_debug("Appending value data\n");
 			}
 			else if (!(value->data)) {
-				value->data = g_memdup(name, namelen+1);
+				value->data = parse_memdup(sd, name, namelen+1);
 				value->data_len = namelen;
 				((char*)(value->data))[value->data_len] = '\0';
 			}
-			else
-				xmlrpc_debug("Got junk after non-scalar value.. ignoring\n");
 			if(value->data && value->data_len>0)
 				xmlrpc_debug("Char element for %d tag\n", tag->name);
 			break;
 		}
+		case Value: {
+			/* Buffer it, the value may still turn out to be typed */
+			if(sd->value_chars_pending) {
+				gsize old_size = sd->value_chars->allocated_len;
+
+				CHECK_STRING_LEN(sd->value_chars->len + namelen);
+				g_string_append_len(sd->value_chars, name, namelen);
+				/* The buffer is reused between values, so only its
+				   growth counts */
+				if(sd->value_chars->allocated_len > old_size) {
+					sd->stats.allocs++;
+					sd->stats.alloc_bytes += sd->value_chars->allocated_len - old_size;
+				}
+				check_alloc_limit(sd);
+			}
+			else
+				xmlrpc_debug("Got junk after non-scalar value.. ignoring\n");
+			break;
+		}
 		case Name: {
 			struct xmlrpc_struct_member *member;
 			
 			/* Copy name to struct member name. Assuming there won't be any newline
 			   chars between name tags.*/
 			CHECK_POINTER(tag->data);
+			CHECK_STRING_LEN(namelen);
 			member = XMLRPC_STRUCT_MEMBER(tag->data);
-			member->name = g_memdup(name, namelen+1);
+			member->name = parse_memdup(sd, name, namelen+1);
 			(member->name)[namelen] = '\0';
 			xmlrpc_debug("Char element: %s\n", member->name);
 			break;
@@ -593,6 +725,19 @@ static void xmlrpc_free_item(parse_state item, void* data) {
 		case Base64_T:
 			g_free(value->data);
 			break;
+		case Base64_File_T: {
+			struct xmlrpc_base64_file *file = value->data;
+
+			if(file && file->owned) {
+				close(file->fd);
+				if(file->path)
+					unlink(file->path);
+			}
+			if(file)
+				g_free(file->path);
+			g_free(file);
+			break;
+		}
 		default:
 		}
 		g_free(value);
@@ -645,6 +790,363 @@ static void xmlrpc_free_item(parse_state item, void* data) {
 	}/* end switch */
 }/* end xmlrpc_free_item() */
 
+/*
+ *  Base64 spilling. Once the encoded text of a <base64> value grows past
+ *  opts.base64_spill_threshold it is decoded in chunks into a file, and the
+ *  value is turned into a Base64_File_T holding only the descriptor.
+ */
+
+static int write_all(int fd, const guchar *buf, int len) {
+	while(len > 0) {
+		int n = write(fd, buf, len);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int base64_char_value(char c) {
+	if(c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if(c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if(c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if(c == '+')
+		return 62;
+	if(c == '/')
+		return 63;
+	return -1;
+}
+
+static int base64_spill_flush(struct base64_spill *spill) {
+	if(write_all(spill->file->fd, spill->out, spill->out_len) < 0)
+		return -1;
+	spill->file->length += spill->out_len;
+	spill->out_len = 0;
+	return 0;
+}
+
+static int base64_spill_start(struct state_data *sd, struct xmlrpc_value *value, int namelen) {
+	struct xmlrpc_base64_file *file;
+	char *text;
+	int text_len, fd;
+
+	if(sd->opts.base64_spill_threshold <= 0 || sd->spill_declined ||
+	   value->data_len + namelen <= sd->opts.base64_spill_threshold)
+		return 0;
+
+	file = parse_new0(sd, struct xmlrpc_base64_file);
+	if(sd->opts.base64_spill_fd) {
+		fd = sd->opts.base64_spill_fd(sd->opts.user_data);
+		if(fd < 0) {
+			/* Caller wants this one kept in memory */
+			g_free(file);
+			sd->spill_declined = 1;
+			return 0;
+		}
+	}
+	else {
+		fd = g_file_open_tmp("xmlrpc-XXXXXX", &file->path, NULL);
+		if(fd < 0) {
+			xmlrpc_debug("Couldn't create base64 spill file\n");
+			g_free(file);
+			sd->spill_declined = 1;
+			return 0;
+		}
+		file->owned = 1;
+#ifndef _WIN32
+		/* Nobody else needs the name, have it go away with the fd */
+		unlink(file->path);
+		g_free(file->path);
+		file->path = NULL;
+#endif
+	}
+	file->fd = fd;
+
+	/* The value now owns the file. Decode what was collected so far. */
+	text = value->data;
+	text_len = value->data_len;
+	value->type = Base64_File_T;
+	value->data = file;
+	value->data_len = 0;
+
+	sd->spill = parse_new0(sd, struct base64_spill);
+	sd->spill->file = file;
+	/* A caller supplied fd needn't be at offset 0 */
+	sd->spill->start = lseek(fd, 0, SEEK_CUR);
+	if(text && base64_spill_chars(sd, text, text_len) < 0)
+		xmlrpc_parse_error(sd, xmlrpc_parse_bad_data, "Bad base64 data or write error\n");
+	g_free(text);
+	return 1;
+}
+
+static int base64_spill_chars(struct state_data *sd, const char *txt, int len) {
+	struct base64_spill *spill = sd->spill;
+	int i;
+
+	for(i = 0; i < len; i++) {
+		int v;
+
+		if(txt[i] == ' ' || txt[i] == '\n' || txt[i] == '\r' || txt[i] == '\t')
+			continue;
+		if(txt[i] == '=') {
+			if(++spill->pad > 2)
+				return -1;
+			continue;
+		}
+		v = base64_char_value(txt[i]);
+		if(v < 0 || spill->pad)
+			return -1;
+		spill->quad = (spill->quad << 6) | v;
+		if(++spill->nquad == 4) {
+			spill->out[spill->out_len++] = spill->quad >> 16;
+			spill->out[spill->out_len++] = spill->quad >> 8;
+			spill->out[spill->out_len++] = spill->quad;
+			spill->quad = 0;
+			spill->nquad = 0;
+			if(spill->out_len > (int)sizeof(spill->out) - 3 &&
+			   base64_spill_flush(spill) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int base64_spill_finish(struct state_data *sd) {
+	struct base64_spill *spill = sd->spill;
+	int ret = 0;
+
+	sd->spill = NULL;
+	if(spill->nquad == 2) {
+		spill->out[spill->out_len++] = spill->quad >> 4;
+	}
+	else if(spill->nquad == 3) {
+		spill->out[spill->out_len++] = spill->quad >> 10;
+		spill->out[spill->out_len++] = spill->quad >> 2;
+	}
+	else if(spill->nquad == 1)
+		ret = -1;
+	if(ret == 0 && base64_spill_flush(spill) < 0)
+		ret = -1;
+	if(ret == 0 && (spill->start < 0 || lseek(spill->file->fd, spill->start, SEEK_SET) < 0))
+		ret = -1;
+	g_free(spill);
+	return ret;
+}
+
+/*
+ *  Scalar conversion helpers. These do not depend on the C locale and only
+ *  accept the exact formats from the xml-rpc spec.
+ */
+
+/* Load 8 chars so that the first one ends up in the low byte */
+static guint64 load_8_chars(const char *s) {
+	const guchar *u = (const guchar*)s;
+
+	return  (guint64)u[0]        | ((guint64)u[1] << 8)  |
+	       ((guint64)u[2] << 16) | ((guint64)u[3] << 24) |
+	       ((guint64)u[4] << 32) | ((guint64)u[5] << 40) |
+	       ((guint64)u[6] << 48) | ((guint64)u[7] << 56);
+}
+
+static int is_8_digits(guint64 val) {
+	return (((val & 0xF0F0F0F0F0F0F0F0ULL) |
+		 (((val + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+		0x3333333333333333ULL);
+}
+
+/* Convert 8 ascii digits, loaded by load_8_chars(), to their value */
+static guint32 parse_8_digits(guint64 val) {
+	val = (val & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+	val = (val & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+	return (guint32)((val & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
+
+static int days_in_month(int year, int month) {
+	static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if(month == 2 && (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0)))
+		return 29;
+	return days[month-1];
+}
+
+/* Days since 1970-01-01 in the proleptic gregorian calendar */
+static glong days_from_civil(int y, int m, int d) {
+	int era, yoe, doy, doe;
+
+	y -= (m <= 2);
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (glong)era * 146097 + doe - 719468;
+}
+
+/* YYYYMMDDTHH:MM:SS with an optional trailing 'Z' */
+static xmlrpc_conv_status parse_iso8601(const char *s, int len, struct tm *tm) {
+	guint64 date, time;
+	guint32 ymd, hms;
+	int year, mon, mday, hour, min, sec;
+
+	if(len == 18 && s[17] == 'Z')
+		len = 17;
+	if(len != 17 || s[8] != 'T')
+		return xmlrpc_conv_syntax;
+
+	date = load_8_chars(s);
+	time = load_8_chars(s + 9);
+	/* Colons sit in bytes 2 and 5 of the time part; swap them for '0'
+	   so the whole thing parses as the digits HH0MM0SS */
+	if((time & 0x0000FF0000FF0000ULL) != 0x00003A00003A0000ULL)
+		return xmlrpc_conv_syntax;
+	time ^= 0x00000A00000A0000ULL;
+	if(!is_8_digits(date) || !is_8_digits(time))
+		return xmlrpc_conv_syntax;
+
+	ymd = parse_8_digits(date);
+	hms = parse_8_digits(time);
+	year = ymd / 10000;
+	mon  = ymd / 100 % 100;
+	mday = ymd % 100;
+	hour = hms / 1000000;
+	min  = hms / 1000 % 100;
+	sec  = hms % 100;
+
+	if(mon < 1 || mon > 12 || mday < 1 || mday > days_in_month(year, mon) ||
+	   hour > 23 || min > 59 || sec > 60)
+		return xmlrpc_conv_range;
+
+	memset(tm, 0, sizeof(struct tm));
+	tm->tm_year = year - 1900;
+	tm->tm_mon = mon - 1;
+	tm->tm_mday = mday;
+	tm->tm_hour = hour;
+	tm->tm_min = min;
+	tm->tm_sec = sec;
+	tm->tm_yday = days_from_civil(year, mon, mday) - days_from_civil(year, 1, 1);
+	tm->tm_wday = (int)((days_from_civil(year, mon, mday) % 7 + 11) % 7);
+	tm->tm_isdst = -1;
+	return xmlrpc_conv_ok;
+}
+
+/* [+-]digits, must fit in 32 bits */
+static xmlrpc_conv_status parse_int(const char *s, int len, int *out) {
+	const char *end = s + len;
+	guint64 acc = 0;
+	int neg = 0;
+
+	if(s < end && (*s == '-' || *s == '+')) {
+		neg = (*s == '-');
+		s++;
+	}
+	if(s == end)
+		return xmlrpc_conv_syntax;
+	/* Leading zeros don't count towards the overflow limit */
+	while(s < end && *s == '0')
+		s++;
+	if(end - s > 10) {
+		for(; s < end; s++)
+			if((unsigned)(*s - '0') > 9)
+				return xmlrpc_conv_syntax;
+		return xmlrpc_conv_range;
+	}
+	for(; s < end; s++) {
+		unsigned d = (unsigned)(*s - '0');
+		if(d > 9)
+			return xmlrpc_conv_syntax;
+		acc = acc * 10 + d;
+	}
+	if(acc > (neg ? (guint64)G_MAXINT + 1 : (guint64)G_MAXINT))
+		return xmlrpc_conv_range;
+	*out = neg ? (int)(0 - acc) : (int)acc;
+	return xmlrpc_conv_ok;
+}
+
+/* [+-]digits[.digits][e[+-]digits]. Values that can be computed exactly
+   with a single multiplication or division take the fast path, anything
+   else falls back to g_ascii_strtod() once the syntax is known to be good. */
+static xmlrpc_conv_status parse_double(const char *s, int len, double *out) {
+	static const double pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const char *start = s, *end = s + len;
+	guint64 mant = 0;
+	int ndigits = 0, frac = 0, exp = 0, neg = 0, dropped = 0;
+	double d;
+
+	if(s < end && (*s == '-' || *s == '+')) {
+		neg = (*s == '-');
+		s++;
+	}
+	for(; s < end && (unsigned)(*s - '0') <= 9; s++, ndigits++) {
+		if(mant < 1000000000000000000ULL)
+			mant = mant * 10 + (*s - '0');
+		else
+			dropped++;
+	}
+	if(s < end && *s == '.') {
+		for(s++; s < end && (unsigned)(*s - '0') <= 9; s++, ndigits++) {
+			if(mant < 1000000000000000000ULL) {
+				mant = mant * 10 + (*s - '0');
+				frac++;
+			}
+		}
+	}
+	if(ndigits == 0)
+		return xmlrpc_conv_syntax;
+	if(s < end && (*s == 'e' || *s == 'E')) {
+		int eneg = 0, edigits = 0;
+
+		s++;
+		if(s < end && (*s == '-' || *s == '+')) {
+			eneg = (*s == '-');
+			s++;
+		}
+		for(; s < end && (unsigned)(*s - '0') <= 9; s++, edigits++)
+			if(exp < 10000)
+				exp = exp * 10 + (*s - '0');
+		if(edigits == 0)
+			return xmlrpc_conv_syntax;
+		if(eneg)
+			exp = -exp;
+	}
+	if(s != end)
+		return xmlrpc_conv_syntax;
+
+	exp += dropped - frac;
+	if(mant <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+		d = (double)mant;
+		d = exp < 0 ? d / pow10[-exp] : d * pow10[exp];
+	}
+	else {
+		/* The value text isn't nul terminated when parsing a chunk */
+		gchar *tmp = g_strndup(start, len);
+		d = g_ascii_strtod(tmp, NULL);
+		g_free(tmp);
+		if(isinf(d))
+			return xmlrpc_conv_range;
+		*out = d;
+		return xmlrpc_conv_ok;
+	}
+	*out = neg ? -d : d;
+	return xmlrpc_conv_ok;
+}
+
+static xmlrpc_conv_status check_value(const struct xmlrpc_value *value, xmlrpc_type type) {
+	if(!value || value->type != type)
+		return xmlrpc_conv_wrong_type;
+	if(!value->data)
+		return xmlrpc_conv_no_data;
+	return xmlrpc_conv_ok;
+}
+
 /*
  *  PUBLIC CODE
  */
@@ -670,43 +1172,205 @@ static void xmlrpc_free_tagstack(stack *s) {
 	g_free(s);
 }
 
-struct xmlrpc_response *xmlrpc_parse(const char *xml_buffer) {
+struct xmlrpc_parser *xmlrpc_parser_new(const struct xmlrpc_parse_options *opts) {
+	struct xmlrpc_parser *parser;
 	XML_Parser p = XML_ParserCreate(NULL);
-	struct state_data *sd = g_new0(struct state_data, 1);
-	struct xmlrpc_response *ret=NULL;
-
-	/* initialize state data */
-	sd->tag_stack = stack_new();
-	sd->error = 0;
 
 	if (! p) {
 		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - Couldn't allocate memory for parser\n");
 		return NULL;
 	}
-	
+
+	parser = g_new0(struct xmlrpc_parser, 1);
+	parser->p = p;
+	parser->sd = g_new0(struct state_data, 1);
+	parser->sd->p = p;
+
+	/* initialize state data */
+	parser->sd->tag_stack = stack_new();
+	parser->sd->error = 0;
+	parser->sd->value_chars = g_string_new(NULL);
+	parser->sd->value_chars_pending = 0;
+	if(opts)
+		parser->sd->opts = *opts;
+	parser->sd->stats.parses = 1;
+	parser->sd->timer = g_timer_new();
+
 	XML_SetElementHandler(p, start_event, end_event);
 	XML_SetCharacterDataHandler(p, char_event);
 	XML_SetProcessingInstructionHandler(p, proc_event);
-	XML_SetUserData(p, (void*)sd);
+	XML_SetUserData(p, (void*)parser->sd);
 
-	if (!XML_Parse(p, xml_buffer, strlen(xml_buffer), 1) || sd->error) {
-		if(!sd->error) {
-			gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - xml parse error at line %d:\n%s\n",
-				     XML_GetCurrentLineNumber(p),
-				     XML_ErrorString(XML_GetErrorCode(p)));
-		}
+	return parser;
+}
+
+static int latency_bucket(double seconds) {
+	double limit = 1e-6;
+	int i;
+
+	for(i = 0; i < XMLRPC_LATENCY_BUCKETS - 1; i++, limit *= 2)
+		if(seconds < limit)
+			break;
+	return i;
+}
+
+static void xmlrpc_parser_stats_done(struct state_data *sd) {
+	struct xmlrpc_parse_stats *st = &sd->stats;
+	int i;
+
+	st->status[sd->error]++;
+	st->latency[latency_bucket(st->seconds)]++;
+	if(sd->opts.stats)
+		*sd->opts.stats = *st;
+
+	G_LOCK(global_stats);
+	global_stats.parses += st->parses;
+	global_stats.bytes += st->bytes;
+	global_stats.elements += st->elements;
+	global_stats.allocs += st->allocs;
+	global_stats.alloc_bytes += st->alloc_bytes;
+	global_stats.seconds += st->seconds;
+	if(st->max_depth > global_stats.max_depth)
+		global_stats.max_depth = st->max_depth;
+	for(i = 0; i < XMLRPC_TYPE_COUNT; i++)
+		global_stats.values[i] += st->values[i];
+	for(i = 0; i < XMLRPC_PARSE_STATUS_COUNT; i++)
+		global_stats.status[i] += st->status[i];
+	for(i = 0; i < XMLRPC_LATENCY_BUCKETS; i++)
+		global_stats.latency[i] += st->latency[i];
+	G_UNLOCK(global_stats);
+}
+
+static void xmlrpc_parser_free(struct xmlrpc_parser *parser) {
+	XML_ParserFree(parser->p);
+	g_timer_destroy(parser->sd->timer);
+	g_free(parser->sd->spill);
+	g_string_free(parser->sd->value_chars, TRUE);
+	g_free(parser->sd);
+	g_free(parser);
+}
+
+int xmlrpc_parser_feed(struct xmlrpc_parser *parser, const char *buf, int len) {
+	int ok;
+
+	if(parser->sd->error)
+		return -1;
+	parser->sd->stats.bytes += len;
+	g_timer_start(parser->sd->timer);
+	ok = XML_Parse(parser->p, buf, len, 0);
+	parser->sd->stats.seconds += g_timer_elapsed(parser->sd->timer, NULL);
+	/* If we stopped expat ourselves the reason is already recorded */
+	if (!ok && !parser->sd->error) {
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - xml parse error at line %d:\n%s\n",
+			     XML_GetCurrentLineNumber(parser->p),
+			     XML_ErrorString(XML_GetErrorCode(parser->p)));
+		parser->sd->error = xmlrpc_parse_xml_error;
+	}
+	return parser->sd->error ? -1 : 0;
+}
+
+struct xmlrpc_response *xmlrpc_parser_finish(struct xmlrpc_parser *parser) {
+	struct state_data *sd = parser->sd;
+	struct xmlrpc_response *ret=NULL;
+
+	g_timer_start(sd->timer);
+	/* Handlers still run for this last call, don't overwrite an error
+	   one of them recorded */
+	if(!sd->error && !XML_Parse(parser->p, NULL, 0, 1) && !sd->error) {
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - xml parse error at line %d:\n%s\n",
+			     XML_GetCurrentLineNumber(parser->p),
+			     XML_ErrorString(XML_GetErrorCode(parser->p)));
+		sd->error = xmlrpc_parse_xml_error;
+	}
+	sd->stats.seconds += g_timer_elapsed(sd->timer, NULL);
+	xmlrpc_parser_stats_done(sd);
+	if(sd->opts.status)
+		*sd->opts.status = sd->error;
+	if (sd->error) {
 		xmlrpc_free_response(sd->response);
 		xmlrpc_free_tagstack(sd->tag_stack);
-		g_free(sd);
-		/* Dump the xml for debugging */
-		gaim_debug(GAIM_DEBUG_INFO, "blogger", "xmlrpc: Error parsing xmlrpc.. Dumping xml..:\n", xml_buffer);
+		xmlrpc_parser_free(parser);
+		gaim_debug(GAIM_DEBUG_INFO, "blogger", "xmlrpc: Error parsing xmlrpc\n");
 		return NULL;
 	}
 	ret = sd->response;
 	stack_free(sd->tag_stack);
-	g_free(sd);
+	xmlrpc_parser_free(parser);
 	gaim_debug(GAIM_DEBUG_INFO, "blogger", "Success parsing xmlrpc\n");
 
 	return ret;
 }
 
+struct xmlrpc_response *xmlrpc_parse_with_options(const char *xml_buffer, const struct xmlrpc_parse_options *opts) {
+	struct xmlrpc_parser *parser = xmlrpc_parser_new(opts);
+
+	if(!parser)
+		return NULL;
+	xmlrpc_parser_feed(parser, xml_buffer, strlen(xml_buffer));
+	return xmlrpc_parser_finish(parser);
+}
+
+struct xmlrpc_response *xmlrpc_parse(const char *xml_buffer) {
+	return xmlrpc_parse_with_options(xml_buffer, NULL);
+}
+
+void xmlrpc_get_stats(struct xmlrpc_parse_stats *stats) {
+	G_LOCK(global_stats);
+	*stats = global_stats;
+	G_UNLOCK(global_stats);
+}
+
+void xmlrpc_reset_stats(void) {
+	G_LOCK(global_stats);
+	memset(&global_stats, 0, sizeof(global_stats));
+	G_UNLOCK(global_stats);
+}
+
+xmlrpc_conv_status xmlrpc_value_get_int(const struct xmlrpc_value *value, int *out) {
+	xmlrpc_conv_status ret = check_value(value, Integer_T);
+
+	if(ret != xmlrpc_conv_ok)
+		return ret;
+	return parse_int((const char*)value->data, value->data_len, out);
+}
+
+xmlrpc_conv_status xmlrpc_value_get_boolean(const struct xmlrpc_value *value, int *out) {
+	xmlrpc_conv_status ret = check_value(value, Boolean_T);
+	const char *s;
+
+	if(ret != xmlrpc_conv_ok)
+		return ret;
+	s = (const char*)value->data;
+	if(value->data_len != 1 || (s[0] != '0' && s[0] != '1'))
+		return xmlrpc_conv_syntax;
+	*out = (s[0] == '1');
+	return xmlrpc_conv_ok;
+}
+
+xmlrpc_conv_status xmlrpc_value_get_double(const struct xmlrpc_value *value, double *out) {
+	xmlrpc_conv_status ret = check_value(value, Double_T);
+
+	if(ret != xmlrpc_conv_ok)
+		return ret;
+	return parse_double((const char*)value->data, value->data_len, out);
+}
+
+xmlrpc_conv_status xmlrpc_value_get_datetime(const struct xmlrpc_value *value, struct tm *out) {
+	xmlrpc_conv_status ret = check_value(value, DateTime_iso8601_T);
+
+	if(ret != xmlrpc_conv_ok)
+		return ret;
+	return parse_iso8601((const char*)value->data, value->data_len, out);
+}
+
+xmlrpc_conv_status xmlrpc_value_get_time(const struct xmlrpc_value *value, time_t *out) {
+	struct tm tm;
+	xmlrpc_conv_status ret = xmlrpc_value_get_datetime(value, &tm);
+
+	if(ret != xmlrpc_conv_ok)
+		return ret;
+	/* glong is 32 bit on win32, do the math in 64 bits */
+	*out = (time_t)((gint64)days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+			tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec);
+	return xmlrpc_conv_ok;
+}
@@ -22,6 +22,8 @@
 #ifndef _XMLRPC_H_
 #define _XMLRPC_H_
 
+#include <time.h>
+
 /* Allow for macro expansion of the args */
 
 #define XMLRPC_RESPONSE(x)        ((struct xmlrpc_response*)x)
@@ -54,15 +56,50 @@ typedef enum _xmlrpc_type {
 	DateTime_iso8601_T,
 	Base64_T,
 	Struct_T,
-	Array_T
+	Array_T,
+	Base64_File_T	/* base64 decoded into a file, see xmlrpc_parse_options */
 } xmlrpc_type;
 
+#define XMLRPC_TYPE_COUNT (Base64_File_T + 1)
+
+/* How a parse ended */
+typedef enum _xmlrpc_parse_status {
+	xmlrpc_parse_ok = 0,
+	xmlrpc_parse_xml_error,		/* not well formed xml */
+	xmlrpc_parse_bad_structure,	/* tags nested in a way xml-rpc doesn't allow */
+	xmlrpc_parse_unknown_tag,
+	xmlrpc_parse_bad_data,		/* bad base64, or the spill file couldn't be written */
+	xmlrpc_parse_limit_memory,	/* xmlrpc_parse_options limits */
+	xmlrpc_parse_limit_elements,
+	xmlrpc_parse_limit_string,
+	xmlrpc_parse_limit_depth,
+	xmlrpc_parse_fault,		/* schema decoder only: the response is a <fault> */
+	XMLRPC_PARSE_STATUS_COUNT
+} xmlrpc_parse_status;
+
+/* Result of the typed xmlrpc_value accessors */
+typedef enum _xmlrpc_conv_status {
+	xmlrpc_conv_ok = 0,
+	xmlrpc_conv_wrong_type,	/* value is NULL or not of the requested type */
+	xmlrpc_conv_no_data,	/* value has no text */
+	xmlrpc_conv_syntax,	/* text doesn't match the xml-rpc format */
+	xmlrpc_conv_range	/* well formed, but doesn't fit the C type */
+} xmlrpc_conv_status;
+
 struct xmlrpc_value {
 	xmlrpc_type type;
 	void *data;
 	int data_len; /* used for scalar types */
 };
 
+/* data of a Base64_File_T value */
+struct xmlrpc_base64_file {
+	int fd;		/* decoded bytes, positioned at the first one */
+	long length;	/* number of decoded bytes */
+	int owned;	/* fd is closed by xmlrpc_free_response() */
+	char *path;	/* temp file still to be removed, if any */
+};
+
 struct xmlrpc_param {
 	struct xmlrpc_value *value;
 };
@@ -95,7 +132,86 @@ struct xmlrpc_response {
 	void *data;
 };
 
+#define XMLRPC_LATENCY_BUCKETS 24
+
+/* Parser counters, for a single parse or summed over the process */
+struct xmlrpc_parse_stats {
+	unsigned long parses;
+	unsigned long bytes;		/* xml fed to the parser */
+	unsigned long elements;
+	unsigned long values[XMLRPC_TYPE_COUNT];
+	unsigned long allocs;		/* allocations made building the tree */
+	unsigned long alloc_bytes;
+	unsigned int max_depth;
+	double seconds;			/* time spent parsing */
+	unsigned long status[XMLRPC_PARSE_STATUS_COUNT];
+	/* Bucket i counts parses that took less than 2^i microseconds and
+	   didn't fit an earlier bucket. The last one takes everything else. */
+	unsigned long latency[XMLRPC_LATENCY_BUCKETS];
+};
+
+struct xmlrpc_parse_options {
+	/* <base64> values whose encoded text grows past this many bytes are
+	   decoded into a file instead of being kept in memory. 0 disables. */
+	int base64_spill_threshold;
+	/* Returns the fd to decode a large base64 value into, or -1 to keep
+	   it in memory. The fd isn't closed by us. Decoding starts at the
+	   fd's current offset, and it's seeked back there when done. When
+	   NULL, an anonymous temp file is used. */
+	int (*base64_spill_fd)(void *user_data);
+	void *user_data;
+	/* When set, receives the counters for this parse once it's finished */
+	struct xmlrpc_parse_stats *stats;
+	/* When set, receives how the parse ended */
+	xmlrpc_parse_status *status;
+	/* Per parse resource limits, 0 means no limit. Parsing stops as soon
+	   as one is exceeded. Base64 spilled to a file doesn't count against
+	   max_string_len. */
+	unsigned long max_alloc_bytes;
+	unsigned long max_elements;
+	unsigned long max_string_len;
+	unsigned int max_depth;
+};
+
+/* Incremental parsing. Feed the response as it arrives, then finish to
+   get the result. finish always frees the parser. */
+struct xmlrpc_parser;
+
+struct xmlrpc_parser *xmlrpc_parser_new(const struct xmlrpc_parse_options *opts);
+int xmlrpc_parser_feed(struct xmlrpc_parser *parser, const char *buf, int len);
+struct xmlrpc_response *xmlrpc_parser_finish(struct xmlrpc_parser *parser);
+
 void xmlrpc_free_response(struct xmlrpc_response *resp);
 struct xmlrpc_response *xmlrpc_parse(const char *xml_buffer);
+struct xmlrpc_response *xmlrpc_parse_with_options(const char *xml_buffer, const struct xmlrpc_parse_options *opts);
+
+/* Totals over all parses since startup or the last reset */
+void xmlrpc_get_stats(struct xmlrpc_parse_stats *stats);
+void xmlrpc_reset_stats(void);
+
+/* Typed, locale independent accessors for scalar values. The output
+   argument is only written when xmlrpc_conv_ok is returned. Date/times are
+   taken as UTC, since xml-rpc carries no timezone. */
+xmlrpc_conv_status xmlrpc_value_get_int(const struct xmlrpc_value *value, int *out);
+xmlrpc_conv_status xmlrpc_value_get_boolean(const struct xmlrpc_value *value, int *out);
+xmlrpc_conv_status xmlrpc_value_get_double(const struct xmlrpc_value *value, double *out);
+xmlrpc_conv_status xmlrpc_value_get_datetime(const struct xmlrpc_value *value, struct tm *out);
+xmlrpc_conv_status xmlrpc_value_get_time(const struct xmlrpc_value *value, time_t *out);
+
+/* Reference counted, read-only responses, for handing one parsed response
+   to several threads without copying it. xmlrpc_share_response() takes
+   over resp, which must not be changed or freed by the caller after that.
+   A subtree handle keeps the whole tree alive, so the handle it came
+   from may be released first. Base64_File_T values share one fd; read
+   them with pread() when more than one thread is involved. */
+struct xmlrpc_ref;
+
+struct xmlrpc_ref *xmlrpc_share_response(struct xmlrpc_response *resp);
+struct xmlrpc_ref *xmlrpc_ref_retain(struct xmlrpc_ref *ref);
+struct xmlrpc_ref *xmlrpc_ref_subtree(struct xmlrpc_ref *ref, const struct xmlrpc_value *value);
+void xmlrpc_ref_release(struct xmlrpc_ref *ref);
+const struct xmlrpc_response *xmlrpc_ref_response(const struct xmlrpc_ref *ref);
+/* param (or fault) value for a whole response, the subtree root otherwise */
+const struct xmlrpc_value *xmlrpc_ref_value(const struct xmlrpc_ref *ref);
 
 #endif /* _XMLRPC_H_ */
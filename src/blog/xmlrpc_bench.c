@@ -0,0 +1,174 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Scalar conversion benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Standalone tool, not part of the plugin. Times the typed xmlrpc_value
+ * accessors against the libc routines consumers used before them
+ * (strptime()+timegm(), sscanf(), strtod()) on the same inputs, and
+ * checks both agree. POSIX only.
+ *
+ *   cc -o xmlrpc_bench xmlrpc_bench.c xmlrpc.c stack.c \
+ *      `pkg-config --cflags --libs glib-2.0` -lexpat -lm
+ *
+ *   xmlrpc_bench [count]     values per type (1000000)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include "xmlrpc.h"
+#include "debug.h"
+
+#define TEXT_LEN 32
+
+/* We're not running inside gaim */
+void gaim_debug(GaimDebugLevel level, const char *category, const char *format, ...) {
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, int count, double ours, double libc, int mismatches) {
+	printf("%-10s xmlrpc %7.1f ns  libc %7.1f ns  speedup %5.2fx  mismatches %d\n",
+	       what, ours / count * 1e9, libc / count * 1e9, libc / ours, mismatches);
+}
+
+static void bench_datetime(char *text, int count) {
+	struct xmlrpc_value value;
+	time_t *ours = g_new(time_t, count), *theirs = g_new(time_t, count);
+	double t0, t1, t2;
+	int i, mismatches = 0;
+
+	for(i = 0; i < count; i++) {
+		time_t t = (time_t)(rand() % 2000000000);
+		struct tm tm;
+
+		gmtime_r(&t, &tm);
+		strftime(text + i * TEXT_LEN, TEXT_LEN, "%Y%m%dT%H:%M:%S", &tm);
+	}
+
+	value.type = DateTime_iso8601_T;
+	t0 = now();
+	for(i = 0; i < count; i++) {
+		value.data = text + i * TEXT_LEN;
+		value.data_len = 17;
+		if(xmlrpc_value_get_time(&value, &ours[i]) != xmlrpc_conv_ok)
+			ours[i] = -1;
+	}
+	t1 = now();
+	for(i = 0; i < count; i++) {
+		struct tm tm;
+
+		memset(&tm, 0, sizeof(tm));
+		if(strptime(text + i * TEXT_LEN, "%Y%m%dT%H:%M:%S", &tm))
+			theirs[i] = timegm(&tm);
+		else
+			theirs[i] = -1;
+	}
+	t2 = now();
+
+	for(i = 0; i < count; i++)
+		mismatches += (ours[i] != theirs[i]);
+	report("dateTime", count, t1 - t0, t2 - t1, mismatches);
+	g_free(ours);
+	g_free(theirs);
+}
+
+static void bench_int(char *text, int count) {
+	struct xmlrpc_value value;
+	int *ours = g_new(int, count), *theirs = g_new(int, count);
+	double t0, t1, t2;
+	int i, mismatches = 0;
+
+	for(i = 0; i < count; i++)
+		g_snprintf(text + i * TEXT_LEN, TEXT_LEN, "%d", rand() - RAND_MAX / 2);
+
+	value.type = Integer_T;
+	t0 = now();
+	for(i = 0; i < count; i++) {
+		value.data = text + i * TEXT_LEN;
+		value.data_len = strlen(value.data);
+		if(xmlrpc_value_get_int(&value, &ours[i]) != xmlrpc_conv_ok)
+			ours[i] = 0;
+	}
+	t1 = now();
+	for(i = 0; i < count; i++)
+		if(sscanf(text + i * TEXT_LEN, "%d", &theirs[i]) != 1)
+			theirs[i] = 0;
+	t2 = now();
+
+	for(i = 0; i < count; i++)
+		mismatches += (ours[i] != theirs[i]);
+	report("int", count, t1 - t0, t2 - t1, mismatches);
+	g_free(ours);
+	g_free(theirs);
+}
+
+static void bench_double(char *text, int count) {
+	struct xmlrpc_value value;
+	double *ours = g_new(double, count), *theirs = g_new(double, count);
+	double t0, t1, t2;
+	int i, mismatches = 0;
+
+	for(i = 0; i < count; i++) {
+		double d = (rand() - RAND_MAX / 2) / 1000.0;
+		/* Mostly short decimals as servers send them, some full precision */
+		g_snprintf(text + i * TEXT_LEN, TEXT_LEN, (i % 8) ? "%.3f" : "%.17g", d);
+	}
+
+	value.type = Double_T;
+	t0 = now();
+	for(i = 0; i < count; i++) {
+		value.data = text + i * TEXT_LEN;
+		value.data_len = strlen(value.data);
+		if(xmlrpc_value_get_double(&value, &ours[i]) != xmlrpc_conv_ok)
+			ours[i] = 0;
+	}
+	t1 = now();
+	for(i = 0; i < count; i++)
+		theirs[i] = strtod(text + i * TEXT_LEN, NULL);
+	t2 = now();
+
+	for(i = 0; i < count; i++)
+		mismatches += (ours[i] != theirs[i]);
+	report("double", count, t1 - t0, t2 - t1, mismatches);
+	g_free(ours);
+	g_free(theirs);
+}
+
+int main(int argc, char **argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 1000000;
+	char *text;
+
+	if(count < 1)
+		return 1;
+	text = g_malloc0((gsize)count * TEXT_LEN);
+	srand(1);
+	bench_datetime(text, count);
+	bench_int(text, count);
+	bench_double(text, count);
+	g_free(text);
+	return 0;
+}
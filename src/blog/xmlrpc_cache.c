@@ -0,0 +1,402 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Response cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <glib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <io.h>
+#endif
+#include "xmlrpc.h"
+#include "xmlrpc_cache.h"
+#include "debug.h"
+
+/*
+ * Cache file, 32 bit words in host byte order:
+ *
+ *   magic, entry count
+ *   per entry: expiry (64 bit time_t, 0 = never), key length,
+ *              snapshot size, key (padded to 4), snapshot
+ *
+ * Snapshots stay 4 byte aligned inside the file, so entries loaded from
+ * it point straight into the mapping.
+ */
+#define CACHE_MAGIC  0x31435258	/* "XRC1" */
+
+struct cache_entry {
+	char *key;
+	int key_len;
+	struct xmlrpc_snapshot snap;
+	gint64 expires;
+	int mapped;	/* key and snap point into cache->map */
+	struct cache_entry *prev, *next;
+};
+
+struct xmlrpc_cache {
+	GHashTable *entries;
+	/* most recently used first */
+	struct cache_entry *head, *tail;
+	int count;
+	long bytes;
+	int max_entries;
+	long max_bytes;
+	int ttl;
+	char *path;
+	void *map;
+	gsize map_len;
+	/* lookup key, kept around to save an allocation per call */
+	GString *scratch;
+};
+
+/*
+ *  PRIVATE CODE
+ */
+
+static guint key_hash(gconstpointer p) {
+	const struct cache_entry *e = p;
+	guint32 h = 2166136261U;
+	int i;
+
+	for(i = 0; i < e->key_len; i++)
+		h = (h ^ (guchar)e->key[i]) * 16777619U;
+	return h;
+}
+
+static gboolean key_equal(gconstpointer a, gconstpointer b) {
+	const struct cache_entry *x = a, *y = b;
+
+	return x->key_len == y->key_len && memcmp(x->key, y->key, x->key_len) == 0;
+}
+
+static void make_key(struct xmlrpc_cache *cache, struct cache_entry *probe,
+		     const char *method, const char *params, int params_len) {
+	g_string_truncate(cache->scratch, 0);
+	g_string_append(cache->scratch, method);
+	g_string_append_len(cache->scratch, "", 1);
+	g_string_append_len(cache->scratch, params, params_len);
+	probe->key = cache->scratch->str;
+	probe->key_len = cache->scratch->len;
+}
+
+static void lru_unlink(struct xmlrpc_cache *cache, struct cache_entry *e) {
+	if(e->prev)
+		e->prev->next = e->next;
+	else
+		cache->head = e->next;
+	if(e->next)
+		e->next->prev = e->prev;
+	else
+		cache->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void lru_push_head(struct xmlrpc_cache *cache, struct cache_entry *e) {
+	e->prev = NULL;
+	e->next = cache->head;
+	if(cache->head)
+		cache->head->prev = e;
+	cache->head = e;
+	if(!cache->tail)
+		cache->tail = e;
+}
+
+static void entry_remove(struct xmlrpc_cache *cache, struct cache_entry *e) {
+	g_hash_table_remove(cache->entries, e);
+	lru_unlink(cache, e);
+	cache->count--;
+	cache->bytes -= e->key_len + e->snap.size;
+	if(!e->mapped) {
+		g_free(e->key);
+		g_free((void*)e->snap.data);
+	}
+	g_free(e);
+}
+
+static void entry_add(struct xmlrpc_cache *cache, struct cache_entry *e) {
+	struct cache_entry *old = g_hash_table_lookup(cache->entries, e);
+
+	if(old)
+		entry_remove(cache, old);
+	g_hash_table_insert(cache->entries, e, e);
+	lru_push_head(cache, e);
+	cache->count++;
+	cache->bytes += e->key_len + e->snap.size;
+
+	while(cache->tail && cache->tail != e &&
+	      ((cache->max_entries && cache->count > cache->max_entries) ||
+	       (cache->max_bytes && cache->bytes > cache->max_bytes)))
+		entry_remove(cache, cache->tail);
+}
+
+static struct cache_entry *entry_find(struct xmlrpc_cache *cache, const char *method,
+				      const char *params, int params_len) {
+	struct cache_entry probe, *e;
+
+	make_key(cache, &probe, method, params, params_len);
+	e = g_hash_table_lookup(cache->entries, &probe);
+	if(!e)
+		return NULL;
+	if(e->expires && e->expires <= (gint64)time(NULL)) {
+		entry_remove(cache, e);
+		return NULL;
+	}
+	lru_unlink(cache, e);
+	lru_push_head(cache, e);
+	return e;
+}
+
+static void cache_load(struct xmlrpc_cache *cache) {
+	const guchar *p, *end;
+	guint32 magic, count, i;
+	gint64 now = time(NULL);
+	struct stat st;
+	int fd;
+
+#ifndef _WIN32
+	fd = open(cache->path, O_RDONLY);
+#else
+	/* Text mode read() would stop short on CR/LF bytes */
+	fd = open(cache->path, O_RDONLY | O_BINARY);
+#endif
+	if(fd < 0)
+		return;
+	if(fstat(fd, &st) < 0 || st.st_size < 8) {
+		close(fd);
+		return;
+	}
+	cache->map_len = st.st_size;
+#ifndef _WIN32
+	cache->map = mmap(NULL, cache->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(cache->map == MAP_FAILED)
+		cache->map = NULL;
+#else
+	cache->map = g_malloc(cache->map_len);
+	if(read(fd, cache->map, cache->map_len) != (int)cache->map_len) {
+		g_free(cache->map);
+		cache->map = NULL;
+	}
+#endif
+	close(fd);
+	if(!cache->map)
+		return;
+
+	p = cache->map;
+	end = p + cache->map_len;
+	memcpy(&magic, p, 4);
+	memcpy(&count, p + 4, 4);
+	if(magic != CACHE_MAGIC) {
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Ignoring bad cache file %s\n", cache->path);
+		return;
+	}
+	p += 8;
+
+	for(i = 0; i < count; i++) {
+		struct cache_entry *e;
+		guint32 key_len, snap_size;
+		guint64 key_padded;
+		gint64 expires;
+
+		if(end - p < 16)
+			break;
+		memcpy(&expires, p, 8);
+		memcpy(&key_len, p + 8, 4);
+		memcpy(&snap_size, p + 12, 4);
+		p += 16;
+		/* Lengths come from disk, do the math in 64 bits so a huge
+		   key_len can't wrap the padding round up */
+		key_padded = ((guint64)key_len + 3) & ~(guint64)3;
+		if(key_len > G_MAXINT || key_len > (guint64)(end - p) || (snap_size & 3) ||
+		   key_padded + snap_size > (guint64)(end - p)) {
+			gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Truncated or corrupt cache file %s\n", cache->path);
+			break;
+		}
+		if(expires && expires <= now) {
+			p += key_padded + snap_size;
+			continue;
+		}
+		e = g_new0(struct cache_entry, 1);
+		e->key = (char*)p;
+		e->key_len = key_len;
+		e->snap.data = p + key_padded;
+		e->snap.size = snap_size;
+		e->expires = expires;
+		e->mapped = 1;
+		p += key_padded + snap_size;
+		/* Snapshots are validated as they're read, this just weeds out
+		   entries from an incompatible build */
+		if(!xmlrpc_snapshot_root(&e->snap)) {
+			g_free(e);
+			continue;
+		}
+		entry_add(cache, e);
+	}
+}
+
+/*
+ *  PUBLIC CODE
+ */
+
+struct xmlrpc_cache *xmlrpc_cache_new(int max_entries, long max_bytes, int ttl, const char *path) {
+	struct xmlrpc_cache *cache = g_new0(struct xmlrpc_cache, 1);
+
+	cache->entries = g_hash_table_new_full(key_hash, key_equal, NULL, NULL);
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+	cache->ttl = ttl;
+	cache->scratch = g_string_new(NULL);
+	if(path) {
+		cache->path = g_strdup(path);
+		cache_load(cache);
+	}
+	return cache;
+}
+
+int xmlrpc_cache_save(struct xmlrpc_cache *cache) {
+	static const char zeros[4] = { 0, 0, 0, 0 };
+	struct cache_entry *e;
+	gchar *tmp;
+	FILE *f;
+	guint32 magic = CACHE_MAGIC, count = 0;
+	gint64 now = time(NULL);
+	int ok;
+
+	if(!cache->path)
+		return -1;
+	tmp = g_strdup_printf("%s.tmp", cache->path);
+	if(!(f = fopen(tmp, "wb"))) {
+		g_free(tmp);
+		return -1;
+	}
+
+	for(e = cache->head; e; e = e->next)
+		if(!e->expires || e->expires > now)
+			count++;
+	fwrite(&magic, 4, 1, f);
+	fwrite(&count, 4, 1, f);
+	/* Oldest first, so loading leaves the newest at the head */
+	for(e = cache->tail; e; e = e->prev) {
+		guint32 key_len = e->key_len, snap_size = e->snap.size;
+
+		if(e->expires && e->expires <= now)
+			continue;
+		fwrite(&e->expires, 8, 1, f);
+		fwrite(&key_len, 4, 1, f);
+		fwrite(&snap_size, 4, 1, f);
+		fwrite(e->key, 1, key_len, f);
+		fwrite(zeros, 1, (4 - (key_len & 3)) & 3, f);
+		fwrite(e->snap.data, 1, snap_size, f);
+	}
+	ok = !ferror(f);
+	if(fclose(f) != 0)
+		ok = 0;
+	/* Entries may still point into the old file's mapping, but renaming
+	   over it leaves that mapping intact */
+#ifdef _WIN32
+	/* rename() won't replace an existing file here. Loaded entries are
+	   a copy, not a mapping, so the old file can go first. */
+	if(ok)
+		unlink(cache->path);
+#endif
+	if(ok && rename(tmp, cache->path) != 0)
+		ok = 0;
+	if(!ok)
+		unlink(tmp);
+	g_free(tmp);
+	return ok ? 0 : -1;
+}
+
+void xmlrpc_cache_free(struct xmlrpc_cache *cache) {
+	if(!cache)
+		return;
+	if(cache->path)
+		xmlrpc_cache_save(cache);
+	while(cache->head)
+		entry_remove(cache, cache->head);
+	g_hash_table_destroy(cache->entries);
+	if(cache->map) {
+#ifndef _WIN32
+		munmap(cache->map, cache->map_len);
+#else
+		g_free(cache->map);
+#endif
+	}
+	g_string_free(cache->scratch, TRUE);
+	g_free(cache->path);
+	g_free(cache);
+}
+
+void xmlrpc_cache_store(struct xmlrpc_cache *cache, const char *method,
+			const char *params, int params_len,
+			const struct xmlrpc_response *resp) {
+	struct cache_entry *e;
+	unsigned char *data;
+	unsigned int size;
+
+	/* Faults aren't worth remembering */
+	if(!resp || resp->type != valid)
+		return;
+	if(!(data = xmlrpc_snapshot_new(resp, &size)))
+		return;
+
+	e = g_new0(struct cache_entry, 1);
+	e->key_len = strlen(method) + 1 + params_len;
+	e->key = g_malloc(e->key_len);
+	memcpy(e->key, method, strlen(method) + 1);
+	memcpy(e->key + strlen(method) + 1, params, params_len);
+	e->snap.data = data;
+	e->snap.size = size;
+	if(cache->ttl > 0)
+		e->expires = (gint64)time(NULL) + cache->ttl;
+	entry_add(cache, e);
+}
+
+const struct xmlrpc_snapshot *xmlrpc_cache_lookup_snapshot(struct xmlrpc_cache *cache, const char *method,
+							   const char *params, int params_len) {
+	struct cache_entry *e = entry_find(cache, method, params, params_len);
+
+	return e ? &e->snap : NULL;
+}
+
+struct xmlrpc_response *xmlrpc_cache_lookup(struct xmlrpc_cache *cache, const char *method,
+					    const char *params, int params_len) {
+	struct cache_entry *e = entry_find(cache, method, params, params_len);
+	struct xmlrpc_response *resp;
+
+	if(!e)
+		return NULL;
+	if(!(resp = xmlrpc_snapshot_to_response(&e->snap))) {
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Dropping corrupt cache entry for %s\n", method);
+		entry_remove(cache, e);
+	}
+	return resp;
+}
+
+void xmlrpc_cache_remove(struct xmlrpc_cache *cache, const char *method,
+			 const char *params, int params_len) {
+	struct cache_entry probe, *e;
+
+	make_key(cache, &probe, method, params, params_len);
+	if((e = g_hash_table_lookup(cache->entries, &probe)))
+		entry_remove(cache, e);
+}
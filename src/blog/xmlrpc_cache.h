@@ -0,0 +1,72 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Response cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef _XMLRPC_CACHE_H_
+#define _XMLRPC_CACHE_H_
+
+struct xmlrpc_response;
+
+/* A response tree flattened into one block. Nodes refer to each other by
+   offset from the start of the block, so it can be copied, written to
+   disk or mmap()ed as is. Nodes are addressed by their offset; 0 means
+   "no node". */
+struct xmlrpc_snapshot {
+	const unsigned char *data;
+	unsigned int size;
+};
+
+/* Returns a g_malloc()ed block, or NULL for responses that can't be
+   flattened (Base64_File_T values). */
+unsigned char *xmlrpc_snapshot_new(const struct xmlrpc_response *resp, unsigned int *size);
+/* Rebuild a normal response tree, NULL if the block is corrupt */
+struct xmlrpc_response *xmlrpc_snapshot_to_response(const struct xmlrpc_snapshot *snap);
+
+/* Read a snapshot in place */
+unsigned int xmlrpc_snapshot_root(const struct xmlrpc_snapshot *snap);
+int xmlrpc_snapshot_type(const struct xmlrpc_snapshot *snap, unsigned int node); /* xmlrpc_type or -1 */
+const char *xmlrpc_snapshot_text(const struct xmlrpc_snapshot *snap, unsigned int node, int *len);
+int xmlrpc_snapshot_count(const struct xmlrpc_snapshot *snap, unsigned int node);
+unsigned int xmlrpc_snapshot_item(const struct xmlrpc_snapshot *snap, unsigned int node, int i);
+const char *xmlrpc_snapshot_member_name(const struct xmlrpc_snapshot *snap, unsigned int node, int i);
+unsigned int xmlrpc_snapshot_member(const struct xmlrpc_snapshot *snap, unsigned int node, const char *name);
+
+/* Client side cache of successful responses to read-only calls, keyed by
+   method name and the serialized params. Entries are kept as snapshots.
+   With a path, entries are loaded from it (mmap()ed, not parsed) when the
+   cache is created and written back by xmlrpc_cache_save() and
+   xmlrpc_cache_free(). Not thread safe. */
+struct xmlrpc_cache;
+
+/* max_entries, max_bytes and ttl (seconds) of 0 mean no limit */
+struct xmlrpc_cache *xmlrpc_cache_new(int max_entries, long max_bytes, int ttl, const char *path);
+void xmlrpc_cache_free(struct xmlrpc_cache *cache);
+int xmlrpc_cache_save(struct xmlrpc_cache *cache);
+
+void xmlrpc_cache_store(struct xmlrpc_cache *cache, const char *method,
+			const char *params, int params_len,
+			const struct xmlrpc_response *resp);
+/* Returns a new response for the caller to free, or NULL on a miss */
+struct xmlrpc_response *xmlrpc_cache_lookup(struct xmlrpc_cache *cache, const char *method,
+					    const char *params, int params_len);
+/* Same, without building a tree. Valid until the cache is next changed. */
+const struct xmlrpc_snapshot *xmlrpc_cache_lookup_snapshot(struct xmlrpc_cache *cache, const char *method,
+							   const char *params, int params_len);
+void xmlrpc_cache_remove(struct xmlrpc_cache *cache, const char *method,
+			 const char *params, int params_len);
+
+#endif /* _XMLRPC_CACHE_H_ */
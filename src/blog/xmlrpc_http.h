@@ -22,6 +22,17 @@
 #ifndef _XMLRPC_HTTP_H_
 #define _XMLRPC_HTTP_H_
 
+/* One piece of a streamed request body. Either literal bytes (buf/len),
+   typically the xml around a payload, or, when buf is NULL, the next
+   fd_len bytes of fd sent base64 encoded. On win32 open the file with
+   O_BINARY. */
+struct xmlrpc_body_part {
+	const char *buf;
+	int len;
+	int fd;
+	long fd_len;
+};
+
 int xmlrpc_http_post(gint fd,
 		     const char* useragent,
 		     const char* cont_type,
@@ -30,4 +41,15 @@ int xmlrpc_http_post(gint fd,
 		     unsigned int length);
 char* xmlrpc_get_http_post_response(char* buf, int *len);
 
+/* Like xmlrpc_http_post(), but the body is sent part by part, so file
+   payloads are encoded on the fly and never held in memory whole.
+   Returns 0 on success, -1 on error. */
+long xmlrpc_body_length(const struct xmlrpc_body_part *parts, int nparts);
+int xmlrpc_http_post_body(gint fd,
+			  const char* useragent,
+			  const char* cont_type,
+			  const char* uri,
+			  const struct xmlrpc_body_part *parts,
+			  int nparts);
+
 #endif /*_XMLRPC_HTTP_H_*/
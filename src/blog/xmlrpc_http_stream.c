@@ -0,0 +1,241 @@
+/*
+ * gaim - Blogger Protocol Plugin - Streaming xmlrpc request bodies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#else
+#include <io.h>
+#endif
+#include "xmlrpc_http.h"
+#include "debug.h"
+
+/* Bytes of file read per round. A multiple of 3, so every chunk but the
+   last encodes without padding. */
+#define RAW_CHUNK    (3 * 16384)
+#define ENC_CHUNK    (4 * 16384)
+#define MAX_IOV      16
+
+static const char b64_alphabet[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ *  PRIVATE CODE
+ */
+
+static long part_length(const struct xmlrpc_body_part *part) {
+	if(part->buf)
+		return part->len;
+	return (part->fd_len + 2) / 3 * 4;
+}
+
+static int base64_encode_chunk(const unsigned char *in, int len, char *out) {
+	char *o = out;
+	int i;
+
+	for(i = 0; i + 2 < len; i += 3) {
+		unsigned int v = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+		*o++ = b64_alphabet[v >> 18];
+		*o++ = b64_alphabet[(v >> 12) & 63];
+		*o++ = b64_alphabet[(v >> 6) & 63];
+		*o++ = b64_alphabet[v & 63];
+	}
+	if(i < len) {
+		unsigned int v = in[i] << 16;
+		if(i + 1 < len)
+			v |= in[i+1] << 8;
+		*o++ = b64_alphabet[v >> 18];
+		*o++ = b64_alphabet[(v >> 12) & 63];
+		*o++ = (i + 1 < len) ? b64_alphabet[(v >> 6) & 63] : '=';
+		*o++ = '=';
+	}
+	return o - out;
+}
+
+#ifdef _WIN32
+/* No writev() here. Send the first non-empty piece, writev_all() treats
+   that like any short write. */
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+static int writev(int fd, const struct iovec *iov, int iovcnt) {
+	int i;
+
+	for(i = 0; i < iovcnt; i++)
+		if(iov[i].iov_len > 0)
+			return write(fd, iov[i].iov_base, iov[i].iov_len);
+	return 0;
+}
+
+/* Sockets are left blocking on win32 */
+static int wait_writable(int fd) {
+	return -1;
+}
+#else
+/* Wait for the socket to drain when it's in non-blocking mode */
+static int wait_writable(int fd) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	while(poll(&pfd, 1, -1) < 0) {
+		if(errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+#endif
+
+/* Send all of iov, coping with short writes. iov is modified. */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+	while(iovcnt > 0) {
+		gssize n = writev(fd, iov, iovcnt);
+
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN && wait_writable(fd) == 0)
+				continue;
+			return -1;
+		}
+		while(iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int read_full(int fd, unsigned char *buf, int len) {
+	int got = 0;
+
+	while(got < len) {
+		gssize n = read(fd, buf + got, len - got);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			break;
+		got += n;
+	}
+	return got;
+}
+
+/*
+ *  PUBLIC CODE
+ */
+
+long xmlrpc_body_length(const struct xmlrpc_body_part *parts, int nparts) {
+	long len = 0;
+	int i;
+
+	for(i = 0; i < nparts; i++)
+		len += part_length(&parts[i]);
+	return len;
+}
+
+int xmlrpc_http_post_body(gint fd,
+			  const char* useragent,
+			  const char* cont_type,
+			  const char* uri,
+			  const struct xmlrpc_body_part *parts,
+			  int nparts) {
+	struct iovec iov[MAX_IOV];
+	unsigned char *raw;
+	char *enc;
+	gchar *header;
+	int iovcnt = 0, i, ret = -1;
+
+	header = g_strdup_printf("POST %s HTTP/1.0\r\n"
+				 "User-Agent: %s\r\n"
+				 "Content-Type: %s\r\n"
+				 "Content-Length: %ld\r\n\r\n",
+				 uri, useragent, cont_type,
+				 xmlrpc_body_length(parts, nparts));
+	raw = g_malloc(RAW_CHUNK);
+	enc = g_malloc(ENC_CHUNK);
+
+	/* Literal parts are only queued, so they go out in the same writev as
+	   the next encoded chunk. The header rides along with the first. */
+	iov[iovcnt].iov_base = header;
+	iov[iovcnt++].iov_len = strlen(header);
+
+	for(i = 0; i < nparts; i++) {
+		const struct xmlrpc_body_part *part = &parts[i];
+		long left;
+
+		if(part->buf) {
+			/* Keep a slot free for the encoded chunk that follows */
+			if(iovcnt >= MAX_IOV - 1) {
+				if(writev_all(fd, iov, iovcnt) < 0)
+					goto out;
+				iovcnt = 0;
+			}
+			iov[iovcnt].iov_base = (void*)part->buf;
+			iov[iovcnt++].iov_len = part->len;
+			continue;
+		}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+		/* Let the kernel read ahead while we're busy on the socket */
+		posix_fadvise(part->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		for(left = part->fd_len; left > 0; ) {
+			int want = left < RAW_CHUNK ? (int)left : RAW_CHUNK;
+			int got = read_full(part->fd, raw, want);
+
+			if(got != want) {
+				/* Content-Length is already promised */
+				gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - short read on upload file\n");
+				goto out;
+			}
+			left -= got;
+			iov[iovcnt].iov_base = enc;
+			iov[iovcnt++].iov_len = base64_encode_chunk(raw, got, enc);
+			if(writev_all(fd, iov, iovcnt) < 0)
+				goto out;
+			iovcnt = 0;
+		}
+	}
+	if(iovcnt > 0 && writev_all(fd, iov, iovcnt) < 0)
+		goto out;
+	ret = 0;
+
+out:
+	if(ret < 0)
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - failed sending request body\n");
+	g_free(header);
+	g_free(raw);
+	g_free(enc);
+	return ret;
+}
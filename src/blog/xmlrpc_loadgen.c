@@ -0,0 +1,496 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Loopback load generator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Standalone tool, not part of the plugin. Starts a small xml-rpc
+ * responder on the loopback interface and drives xmlrpc_http_post(),
+ * xmlrpc_get_http_post_response() and xmlrpc_parse() against it from
+ * several threads, then reports throughput, latency percentiles and
+ * client cpu time per call. POSIX only.
+ *
+ *   cc -o xmlrpc_loadgen xmlrpc_loadgen.c xmlrpc.c xmlrpc_http.c stack.c \
+ *      `pkg-config --cflags --libs glib-2.0 gthread-2.0` -lexpat -lz -lpthread
+ *
+ *   -t threads     client threads (4)
+ *   -n calls       calls per thread (1000)
+ *   -s structs     posts in the generated response (20)
+ *   -f file        serve this file as the response instead
+ *   -l msec        server side latency per call (0)
+ *   -c bytes       server writes the response in pieces of this size (all at once)
+ *   -z             gzip the response (the client inflates before parsing)
+ *   -S             only run the responder, until killed
+ *   -p port        listen on this port (any free one)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include <glib.h>
+#include "xmlrpc.h"
+#include "xmlrpc_http.h"
+#include "debug.h"
+
+struct options {
+	int threads;
+	int calls;
+	int structs;
+	const char *file;
+	int latency_ms;
+	int chunk;
+	int gzip;
+	int serve_only;
+	int port;
+};
+
+struct client {
+	pthread_t thread;
+	int port;
+	double *latency;	/* seconds, one per call */
+	int done;
+	int failed;
+	double cpu;
+};
+
+static struct options opts = { 4, 1000, 20, NULL, 0, 0, 0, 0, 0 };
+
+/* What the responder sends back, built once */
+static char *response;
+static int response_len;
+
+static const char request_body[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<methodCall>\n"
+	"<methodName>blogger.getRecentPosts</methodName>\n"
+	"<params>\n"
+	"<param><value><string>0123456789ABCDEF</string></value></param>\n"
+	"<param><value><string>1</string></value></param>\n"
+	"<param><value><string>user</string></value></param>\n"
+	"<param><value><string>password</string></value></param>\n"
+	"<param><value><int>20</int></value></param>\n"
+	"</params>\n"
+	"</methodCall>\n";
+
+/* We're not running inside gaim */
+void gaim_debug(GaimDebugLevel level, const char *category, const char *format, ...) {
+}
+
+static double now(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, const char *buf, int len) {
+	while(len > 0) {
+		int n = write(fd, buf, len);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ *  Responder
+ */
+
+static GString *generate_response(int structs) {
+	GString *s = g_string_new("<?xml version=\"1.0\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n<array>\n<data>\n");
+	int i;
+
+	for(i = 0; i < structs; i++) {
+		gchar *post = g_strdup_printf(
+			"<value>\n<struct>\n"
+			"<member><name>userid</name><value><string>1234</string></value></member>\n"
+			"<member><name>postid</name><value><string>%d</string></value></member>\n"
+			"<member><name>dateCreated</name><value><dateTime.iso8601>20031010T%02d:%02d:00</dateTime.iso8601></value></member>\n"
+			"<member><name>content</name><value><string>Post number %d. Lorem ipsum dolor sit amet, "
+			"consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore "
+			"magna aliqua.</string></value></member>\n"
+			"</struct>\n</value>\n", i, i / 60 % 24, i % 60, i);
+		g_string_append(s, post);
+		g_free(post);
+	}
+	g_string_append(s, "</data>\n</array>\n</value>\n</param>\n</params>\n</methodResponse>\n");
+	return s;
+}
+
+static int build_response(void) {
+	GString *body;
+	gchar *header;
+	char *data = NULL;
+	int len = 0;
+
+	if(opts.file) {
+		gsize flen;
+		if(!g_file_get_contents(opts.file, &data, &flen, NULL)) {
+			fprintf(stderr, "Can't read %s\n", opts.file);
+			return -1;
+		}
+		len = flen;
+	}
+	else {
+		body = generate_response(opts.structs);
+		len = body->len;
+		data = g_string_free(body, FALSE);
+	}
+
+	if(opts.gzip) {
+		z_stream z;
+		uLong bound;
+		char *out;
+
+		memset(&z, 0, sizeof(z));
+		/* 16 + MAX_WBITS asks zlib for a gzip wrapper */
+		if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return -1;
+		bound = deflateBound(&z, len);
+		out = g_malloc(bound);
+		z.next_in = (Bytef*)data;
+		z.avail_in = len;
+		z.next_out = (Bytef*)out;
+		z.avail_out = bound;
+		deflate(&z, Z_FINISH);
+		len = z.total_out;
+		deflateEnd(&z);
+		g_free(data);
+		data = out;
+	}
+
+	header = g_strdup_printf("HTTP/1.0 200 OK\r\n"
+				 "Server: xmlrpc_loadgen\r\n"
+				 "Content-Type: text/xml\r\n"
+				 "%s"
+				 "Content-Length: %d\r\n\r\n",
+				 opts.gzip ? "Content-Encoding: gzip\r\n" : "", len);
+	response_len = strlen(header) + len;
+	response = g_malloc(response_len);
+	memcpy(response, header, strlen(header));
+	memcpy(response + strlen(header), data, len);
+	g_free(header);
+	g_free(data);
+	return 0;
+}
+
+/* Read the request, headers and Content-Length bytes of body */
+static int read_request(int fd) {
+	char buf[4096];
+	int have = 0, body_len = 0;
+	char *end = NULL;
+
+	while(!end) {
+		int n = read(fd, buf + have, sizeof(buf) - 1 - have);
+		if(n <= 0)
+			return -1;
+		have += n;
+		buf[have] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+		if(!end && have == sizeof(buf) - 1)
+			return -1;
+	}
+	{
+		char *cl = g_strstr_len(buf, end - buf, "Content-Length:");
+		if(cl)
+			body_len = atoi(cl + 15);
+	}
+	body_len -= have - (end + 4 - buf);
+	while(body_len > 0) {
+		int n = read(fd, buf, MIN(body_len, (int)sizeof(buf)));
+		if(n <= 0)
+			return -1;
+		body_len -= n;
+	}
+	return 0;
+}
+
+static void *serve_connection(void *arg) {
+	int fd = GPOINTER_TO_INT(arg);
+
+	if(read_request(fd) == 0) {
+		if(opts.latency_ms)
+			g_usleep(opts.latency_ms * 1000);
+		if(opts.chunk > 0) {
+			int off;
+			for(off = 0; off < response_len; off += opts.chunk)
+				if(write_all(fd, response + off, MIN(opts.chunk, response_len - off)) < 0)
+					break;
+		}
+		else
+			write_all(fd, response, response_len);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void *serve(void *arg) {
+	int listener = GPOINTER_TO_INT(arg);
+
+	for(;;) {
+		pthread_t t;
+		int fd = accept(listener, NULL, NULL);
+
+		if(fd < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		if(pthread_create(&t, NULL, serve_connection, GINT_TO_POINTER(fd)) != 0) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(t);
+	}
+	return NULL;
+}
+
+static int start_responder(int *port) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	pthread_t t;
+	int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+
+	if(fd < 0)
+		return -1;
+	/* So repeated runs on a fixed port don't wait out TIME_WAIT */
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(*port);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+	   listen(fd, 128) < 0 ||
+	   getsockname(fd, (struct sockaddr*)&addr, &addr_len) < 0) {
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+	if(pthread_create(&t, NULL, serve, GINT_TO_POINTER(fd)) != 0)
+		return -1;
+	pthread_detach(t);
+	return 0;
+}
+
+/*
+ *  Clients
+ */
+
+static char *inflate_body(const char *body, int len, int *out_len) {
+	GString *out = g_string_sized_new(len * 4);
+	char buf[16384];
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	if(inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+		return NULL;
+	z.next_in = (Bytef*)body;
+	z.avail_in = len;
+	do {
+		z.next_out = (Bytef*)buf;
+		z.avail_out = sizeof(buf);
+		ret = inflate(&z, Z_NO_FLUSH);
+		g_string_append_len(out, buf, sizeof(buf) - z.avail_out);
+	} while(ret == Z_OK);
+	inflateEnd(&z);
+	if(ret != Z_STREAM_END) {
+		g_string_free(out, TRUE);
+		return NULL;
+	}
+	*out_len = out->len;
+	return g_string_free(out, FALSE);
+}
+
+static int one_call(int port, GString *buf) {
+	struct sockaddr_in addr;
+	struct xmlrpc_response *resp;
+	char *body, *xml;
+	int fd, len, xml_len;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if(xmlrpc_http_post(fd, "xmlrpc_loadgen", "text/xml", "/RPC2",
+			    request_body, sizeof(request_body) - 1) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* HTTP/1.0, the server closes when it's done */
+	g_string_truncate(buf, 0);
+	for(;;) {
+		char chunk[16384];
+		int n = read(fd, chunk, sizeof(chunk));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		g_string_append_len(buf, chunk, n);
+	}
+	close(fd);
+
+	len = buf->len;
+	if(!(body = xmlrpc_get_http_post_response(buf->str, &len)))
+		return -1;
+	if(opts.gzip) {
+		if(!(xml = inflate_body(body, len, &xml_len)))
+			return -1;
+	}
+	else
+		xml = g_strndup(body, len);
+
+	resp = xmlrpc_parse(xml);
+	g_free(xml);
+	if(!resp)
+		return -1;
+	xmlrpc_free_response(resp);
+	return 0;
+}
+
+static void *run_client(void *arg) {
+	struct client *c = arg;
+	GString *buf = g_string_sized_new(response_len + 1);
+	double cpu_start = now(CLOCK_THREAD_CPUTIME_ID);
+	int i;
+
+	for(i = 0; i < opts.calls; i++) {
+		double start = now(CLOCK_MONOTONIC);
+
+		if(one_call(c->port, buf) < 0) {
+			c->failed++;
+			continue;
+		}
+		c->latency[c->done++] = now(CLOCK_MONOTONIC) - start;
+	}
+	c->cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+	g_string_free(buf, TRUE);
+	return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+	int i = (int)(p * n);
+
+	if(n == 0)
+		return 0;
+	return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char **argv) {
+	struct client *clients;
+	double *all, start, wall, cpu = 0;
+	int c, i, port, total = 0, failed = 0;
+
+	while((c = getopt(argc, argv, "t:n:s:f:l:c:zSp:")) != -1) {
+		switch(c) {
+		case 't': opts.threads = atoi(optarg); break;
+		case 'n': opts.calls = atoi(optarg); break;
+		case 's': opts.structs = atoi(optarg); break;
+		case 'f': opts.file = optarg; break;
+		case 'l': opts.latency_ms = atoi(optarg); break;
+		case 'c': opts.chunk = atoi(optarg); break;
+		case 'z': opts.gzip = 1; break;
+		case 'S': opts.serve_only = 1; break;
+		case 'p': opts.port = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-n calls] [-s structs] [-f file] "
+				"[-l msec] [-c bytes] [-z] [-S] [-p port]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(opts.threads < 1 || opts.calls < 1 || opts.port < 0 || opts.port > 65535)
+		return 1;
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	if(!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	/* A client hanging up early must only cost its connection */
+	signal(SIGPIPE, SIG_IGN);
+	port = opts.port;
+	if(build_response() < 0 || start_responder(&port) < 0) {
+		fprintf(stderr, "Couldn't start the responder\n");
+		return 1;
+	}
+	printf("responder on 127.0.0.1:%d, %d byte response%s\n", port, response_len,
+	       opts.gzip ? " (gzip)" : "");
+	/* With -S this is how other clients learn the port, even when
+	   stdout isn't a terminal */
+	fflush(stdout);
+	if(opts.serve_only) {
+		for(;;)
+			pause();
+	}
+
+	clients = g_new0(struct client, opts.threads);
+	start = now(CLOCK_MONOTONIC);
+	for(i = 0; i < opts.threads; i++) {
+		clients[i].port = port;
+		clients[i].latency = g_new(double, opts.calls);
+		pthread_create(&clients[i].thread, NULL, run_client, &clients[i]);
+	}
+	all = g_new(double, opts.threads * opts.calls);
+	for(i = 0; i < opts.threads; i++) {
+		pthread_join(clients[i].thread, NULL);
+		memcpy(all + total, clients[i].latency, clients[i].done * sizeof(double));
+		total += clients[i].done;
+		failed += clients[i].failed;
+		cpu += clients[i].cpu;
+		g_free(clients[i].latency);
+	}
+	wall = now(CLOCK_MONOTONIC) - start;
+	qsort(all, total, sizeof(double), compare_double);
+
+	printf("%d calls, %d failed, %.2f s\n", total, failed, wall);
+	printf("throughput  %.1f calls/s\n", total / wall);
+	printf("latency     p50 %.3f ms  p99 %.3f ms  p999 %.3f ms\n",
+	       percentile(all, total, 0.50) * 1e3,
+	       percentile(all, total, 0.99) * 1e3,
+	       percentile(all, total, 0.999) * 1e3);
+	printf("client cpu  %.1f us/call\n", total ? cpu / total * 1e6 : 0.0);
+
+	g_free(all);
+	g_free(clients);
+	g_free(response);
+	return failed ? 1 : 0;
+}
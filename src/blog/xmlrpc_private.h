@@ -0,0 +1,65 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Parser internals
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef _XMLRPC_PRIVATE_H_
+#define _XMLRPC_PRIVATE_H_
+
+/* Shared by the expat based parsers (xmlrpc.c, xmlrpc_schema.c), not
+   part of the public API. */
+
+#ifndef _WIN32
+#include <expat.h>
+#else
+#include "xmlparse.h"
+#endif
+#include "xmlrpc.h"
+
+/* XML_StopParser() showed up in expat 1.95.8 */
+#if defined(XML_MAJOR_VERSION) && \
+    (XML_MAJOR_VERSION > 1 || (XML_MAJOR_VERSION == 1 && \
+     (XML_MINOR_VERSION > 95 || (XML_MINOR_VERSION == 95 && XML_MICRO_VERSION >= 8))))
+#define HAVE_XML_STOPPARSER 1
+#endif
+
+typedef enum _parse_state {
+	MethodResponse = 0,
+	Params,
+	Param,
+	Value,
+	Integer,
+	Boolean,
+	String,
+	Double,
+	DateTime_iso8601,
+	Base64,
+	Struct,
+	Member,
+	Name,
+	Array,
+	Data,
+	Fault,
+	Unknown
+} parse_state;
+
+/* Maps an element name to its parse_state, Unknown if it isn't one of ours */
+parse_state xmlrpc_get_parse_state(const char *tag);
+/* Sets type for the value tags (scalars, struct and array).
+   Returns -1 for any other state. */
+int xmlrpc_parse_state_type(parse_state state, xmlrpc_type *type);
+
+#endif /* _XMLRPC_PRIVATE_H_ */
@@ -0,0 +1,104 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Shared responses
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <glib.h>
+#include "xmlrpc.h"
+
+/* The parsed tree. It is only freed once the last handle on it, or on
+   any of its subtrees, is released. */
+struct xmlrpc_shared_root {
+	volatile gint refs;
+	struct xmlrpc_response *response;
+};
+
+struct xmlrpc_ref {
+	volatile gint refs;
+	struct xmlrpc_shared_root *root;
+	const struct xmlrpc_value *value;
+};
+
+/*
+ *  PRIVATE CODE
+ */
+
+static struct xmlrpc_ref *new_ref(struct xmlrpc_shared_root *root, const struct xmlrpc_value *value) {
+	struct xmlrpc_ref *ref = g_new0(struct xmlrpc_ref, 1);
+
+	ref->refs = 1;
+	ref->root = root;
+	ref->value = value;
+	g_atomic_int_inc(&root->refs);
+	return ref;
+}
+
+static void root_release(struct xmlrpc_shared_root *root) {
+	if(g_atomic_int_dec_and_test(&root->refs)) {
+		xmlrpc_free_response(root->response);
+		g_free(root);
+	}
+}
+
+/*
+ *  PUBLIC CODE
+ */
+
+struct xmlrpc_ref *xmlrpc_share_response(struct xmlrpc_response *resp) {
+	struct xmlrpc_shared_root *root;
+	const struct xmlrpc_value *value = NULL;
+
+	if(!resp)
+		return NULL;
+
+	root = g_new0(struct xmlrpc_shared_root, 1);
+	root->refs = 0;
+	root->response = resp;
+	if(resp->type == valid)
+		value = SAFE_POINTER_2(XMLRPC_PARAM(resp->data), value);
+	else if(resp->type == fault)
+		value = SAFE_POINTER_2(XMLRPC_FAULT(resp->data), value);
+	return new_ref(root, value);
+}
+
+struct xmlrpc_ref *xmlrpc_ref_retain(struct xmlrpc_ref *ref) {
+	if(ref)
+		g_atomic_int_inc(&ref->refs);
+	return ref;
+}
+
+struct xmlrpc_ref *xmlrpc_ref_subtree(struct xmlrpc_ref *ref, const struct xmlrpc_value *value) {
+	if(!ref || !value)
+		return NULL;
+	return new_ref(ref->root, value);
+}
+
+void xmlrpc_ref_release(struct xmlrpc_ref *ref) {
+	if(!ref)
+		return;
+	if(g_atomic_int_dec_and_test(&ref->refs)) {
+		root_release(ref->root);
+		g_free(ref);
+	}
+}
+
+const struct xmlrpc_response *xmlrpc_ref_response(const struct xmlrpc_ref *ref) {
+	return ref ? ref->root->response : NULL;
+}
+
+const struct xmlrpc_value *xmlrpc_ref_value(const struct xmlrpc_ref *ref) {
+	return ref ? ref->value : NULL;
+}
@@ -0,0 +1,350 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Schema driven decoding
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include "xmlrpc.h"
+#include "xmlrpc_private.h"
+#include "xmlrpc_schema.h"
+#include "debug.h"
+
+/*
+ * Element depths the decoder expects:
+ *
+ *   1 methodResponse, 2 params, 3 param, 4 value,
+ *   5 struct                                   (single struct)
+ *   5 array, 6 data, 7 value, 8 struct         (array of structs)
+ *
+ * Below a <struct> it goes member (+1), name or value (+2) and the type
+ * tag (+3). Anything deeper belongs to a nested value and is skipped.
+ */
+struct xmlrpc_decoder {
+	XML_Parser p;
+	const struct xmlrpc_schema *schema;
+	guchar *out;
+	int max;
+	int count;
+	int error;		/* xmlrpc_parse_status */
+	int depth;
+	int array;		/* top value is an array */
+	int record_depth;	/* depth of the <struct> being filled, 0 if none */
+	guchar *record;
+	const struct xmlrpc_field *field;	/* member being read, NULL to skip it */
+	int in_name;
+	int in_value;
+	int typed;		/* member value has a type tag */
+	int nested;		/* ... which is <struct> or <array> */
+	xmlrpc_type value_type;
+	GString *text;
+};
+
+/*
+ *  PRIVATE CODE
+ */
+
+static void decoder_error(struct xmlrpc_decoder *dec, xmlrpc_parse_status status, const char *what) {
+	if(dec->error)
+		return;
+	dec->error = status;
+	gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error decoding response: %s\n", what);
+#ifdef HAVE_XML_STOPPARSER
+	XML_StopParser(dec->p, XML_FALSE);
+#endif
+}
+
+static const struct xmlrpc_field *find_field(const struct xmlrpc_schema *schema, const char *name) {
+	int i;
+
+	for(i = 0; i < schema->nfields; i++)
+		if(strcmp(schema->fields[i].name, name) == 0)
+			return &schema->fields[i];
+	return NULL;
+}
+
+/* Convert the collected text into the current field */
+static void store_field(struct xmlrpc_decoder *dec) {
+	const struct xmlrpc_field *field = dec->field;
+	void *dst = dec->record + field->offset;
+	struct xmlrpc_value value;
+	xmlrpc_conv_status ret;
+
+	value.type = dec->value_type;
+	value.data = dec->text->str;
+	value.data_len = dec->text->len;
+
+	switch(field->type) {
+	case xmlrpc_field_int:
+		ret = xmlrpc_value_get_int(&value, (int*)dst);
+		break;
+	case xmlrpc_field_boolean:
+		ret = xmlrpc_value_get_boolean(&value, (int*)dst);
+		break;
+	case xmlrpc_field_double:
+		ret = xmlrpc_value_get_double(&value, (double*)dst);
+		break;
+	case xmlrpc_field_time:
+		ret = xmlrpc_value_get_time(&value, (time_t*)dst);
+		break;
+	case xmlrpc_field_datetime:
+		ret = xmlrpc_value_get_datetime(&value, (struct tm*)dst);
+		break;
+	case xmlrpc_field_string:
+		if(value.type != String_T) {
+			ret = xmlrpc_conv_wrong_type;
+			break;
+		}
+		g_free(*(char**)dst);
+		*(char**)dst = g_strndup(dec->text->str, dec->text->len);
+		ret = xmlrpc_conv_ok;
+		break;
+	default:
+		ret = xmlrpc_conv_wrong_type;
+	}
+	if(ret != xmlrpc_conv_ok)
+		decoder_error(dec, xmlrpc_parse_bad_data, field->name);
+}
+
+static void member_start(struct xmlrpc_decoder *dec, const char *tag, int rel) {
+	switch(rel) {
+	case 1:
+		if(strcmp("member", tag) != 0) {
+			decoder_error(dec, xmlrpc_parse_bad_structure, tag);
+			return;
+		}
+		dec->field = NULL;
+		break;
+	case 2:
+		g_string_truncate(dec->text, 0);
+		if(strcmp("name", tag) == 0)
+			dec->in_name = 1;
+		else if(strcmp("value", tag) == 0) {
+			dec->in_value = 1;
+			dec->typed = 0;
+			dec->nested = 0;
+			dec->value_type = String_T;
+		}
+		else
+			decoder_error(dec, xmlrpc_parse_bad_structure, tag);
+		break;
+	case 3:
+		if(!dec->in_value || dec->typed) {
+			decoder_error(dec, xmlrpc_parse_bad_structure, tag);
+			return;
+		}
+		if(xmlrpc_parse_state_type(xmlrpc_get_parse_state(tag), &dec->value_type) < 0) {
+			decoder_error(dec, xmlrpc_parse_unknown_tag, tag);
+			return;
+		}
+		/* Whitespace around the type tag isn't part of the value */
+		g_string_truncate(dec->text, 0);
+		dec->typed = 1;
+		dec->nested = (dec->value_type == Struct_T || dec->value_type == Array_T);
+		break;
+	default:
+		/* inside a nested value */
+		break;
+	}
+}
+
+static void start_event(void *userdata, const char *tag, const char **attr) {
+	struct xmlrpc_decoder *dec = userdata;
+	int d = ++dec->depth, ok;
+
+	if(dec->error)
+		return;
+	if(dec->record_depth) {
+		member_start(dec, tag, d - dec->record_depth);
+		return;
+	}
+
+	switch(d) {
+	case 1:
+		ok = strcmp("methodResponse", tag) == 0;
+		break;
+	case 2:
+		if(strcmp("fault", tag) == 0) {
+			decoder_error(dec, xmlrpc_parse_fault, "fault response");
+			return;
+		}
+		ok = strcmp("params", tag) == 0;
+		break;
+	case 3:
+		ok = strcmp("param", tag) == 0;
+		break;
+	case 4:
+		ok = strcmp("value", tag) == 0;
+		break;
+	case 5:
+		dec->array = (strcmp("array", tag) == 0);
+		ok = dec->array || strcmp("struct", tag) == 0;
+		break;
+	case 6:
+		ok = dec->array && strcmp("data", tag) == 0;
+		break;
+	case 7:
+		ok = dec->array && strcmp("value", tag) == 0;
+		break;
+	case 8:
+		ok = dec->array && strcmp("struct", tag) == 0;
+		break;
+	default:
+		ok = 0;
+	}
+	if(!ok) {
+		decoder_error(dec, xmlrpc_parse_bad_structure, tag);
+		return;
+	}
+
+	/* Start of a record */
+	if((d == 5 && !dec->array) || d == 8) {
+		if(dec->count >= dec->max) {
+			decoder_error(dec, xmlrpc_parse_limit_elements, "more structs than room for them");
+			return;
+		}
+		dec->record = dec->out + dec->count * dec->schema->struct_size;
+		dec->record_depth = d;
+	}
+}
+
+static void end_event(void *userdata, const char *tag) {
+	struct xmlrpc_decoder *dec = userdata;
+	int d = dec->depth--;
+
+	if(dec->error || !dec->record_depth)
+		return;
+
+	switch(d - dec->record_depth) {
+	case 0:
+		dec->count++;
+		dec->record = NULL;
+		dec->record_depth = 0;
+		break;
+	case 2:
+		if(dec->in_name) {
+			dec->in_name = 0;
+			dec->field = find_field(dec->schema, dec->text->str);
+		}
+		else if(dec->in_value) {
+			dec->in_value = 0;
+			if(dec->field && dec->nested)
+				decoder_error(dec, xmlrpc_parse_bad_data, dec->field->name);
+			else if(dec->field)
+				store_field(dec);
+		}
+		break;
+	}
+}
+
+static void char_event(void *userdata, const char *txt, int txtlen) {
+	struct xmlrpc_decoder *dec = userdata;
+	int rel = dec->depth - dec->record_depth;
+
+	if(dec->error || !dec->record_depth)
+		return;
+	if(dec->in_name && rel == 2)
+		g_string_append_len(dec->text, txt, txtlen);
+	else if(dec->in_value && dec->field && !dec->nested &&
+		rel == (dec->typed ? 3 : 2))
+		g_string_append_len(dec->text, txt, txtlen);
+}
+
+/*
+ *  PUBLIC CODE
+ */
+
+struct xmlrpc_decoder *xmlrpc_decoder_new(const struct xmlrpc_schema *schema, void *out, int max) {
+	struct xmlrpc_decoder *dec;
+	XML_Parser p = XML_ParserCreate(NULL);
+
+	if(!p) {
+		gaim_debug(GAIM_DEBUG_WARNING, "blogger", "xmlrpc: Error - Couldn't allocate memory for parser\n");
+		return NULL;
+	}
+	dec = g_new0(struct xmlrpc_decoder, 1);
+	dec->p = p;
+	dec->schema = schema;
+	dec->out = out;
+	dec->max = max;
+	dec->text = g_string_new(NULL);
+
+	XML_SetElementHandler(p, start_event, end_event);
+	XML_SetCharacterDataHandler(p, char_event);
+	XML_SetUserData(p, dec);
+	return dec;
+}
+
+int xmlrpc_decoder_feed(struct xmlrpc_decoder *dec, const char *buf, int len) {
+	if(dec->error)
+		return -1;
+	if(!XML_Parse(dec->p, buf, len, 0) && !dec->error)
+		dec->error = xmlrpc_parse_xml_error;
+	return dec->error ? -1 : 0;
+}
+
+int xmlrpc_decoder_finish(struct xmlrpc_decoder *dec, xmlrpc_parse_status *status) {
+	int ret;
+
+	if(!dec->error && !XML_Parse(dec->p, NULL, 0, 1) && !dec->error)
+		dec->error = xmlrpc_parse_xml_error;
+
+	if(dec->error) {
+		/* Don't hand back half filled structs */
+		xmlrpc_decoded_free(dec->schema, dec->out, dec->count + (dec->record ? 1 : 0));
+		ret = -1;
+	}
+	else
+		ret = dec->count;
+	if(status)
+		*status = dec->error;
+
+	XML_ParserFree(dec->p);
+	g_string_free(dec->text, TRUE);
+	g_free(dec);
+	return ret;
+}
+
+int xmlrpc_decode(const char *xml_buffer, const struct xmlrpc_schema *schema,
+		  void *out, int max, xmlrpc_parse_status *status) {
+	struct xmlrpc_decoder *dec = xmlrpc_decoder_new(schema, out, max);
+
+	if(!dec) {
+		if(status)
+			*status = xmlrpc_parse_xml_error;
+		return -1;
+	}
+	xmlrpc_decoder_feed(dec, xml_buffer, strlen(xml_buffer));
+	return xmlrpc_decoder_finish(dec, status);
+}
+
+void xmlrpc_decoded_free(const struct xmlrpc_schema *schema, void *out, int count) {
+	int i, j;
+
+	for(i = 0; i < count; i++) {
+		guchar *record = (guchar*)out + i * schema->struct_size;
+
+		for(j = 0; j < schema->nfields; j++) {
+			if(schema->fields[j].type == xmlrpc_field_string) {
+				char **s = (char**)(record + schema->fields[j].offset);
+				g_free(*s);
+				*s = NULL;
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Schema driven decoding
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef _XMLRPC_SCHEMA_H_
+#define _XMLRPC_SCHEMA_H_
+
+#include <stddef.h>
+
+/* Decodes responses of a known shape, a struct or an array of structs,
+   straight into caller provided C structs without building an
+   xmlrpc_response tree. Members not in the schema are skipped. Needs
+   xmlrpc.h.
+
+     struct post { char *title; int id; time_t created; };
+
+     static const struct xmlrpc_field post_fields[] = {
+         XMLRPC_FIELD(struct post, title, xmlrpc_field_string, "title"),
+         XMLRPC_FIELD(struct post, id, xmlrpc_field_int, "postid"),
+         XMLRPC_FIELD(struct post, created, xmlrpc_field_time, "dateCreated")
+     };
+     static const struct xmlrpc_schema post_schema = XMLRPC_SCHEMA(struct post, post_fields);
+*/
+
+typedef enum _xmlrpc_field_type {
+	xmlrpc_field_int,	/* int, from <int> or <i4> */
+	xmlrpc_field_boolean,	/* int, from <boolean> */
+	xmlrpc_field_double,	/* double */
+	xmlrpc_field_string,	/* char*, g_malloc()ed. <string> or untyped */
+	xmlrpc_field_time,	/* time_t, from <dateTime.iso8601> */
+	xmlrpc_field_datetime	/* struct tm, from <dateTime.iso8601> */
+} xmlrpc_field_type;
+
+struct xmlrpc_field {
+	const char *name;
+	xmlrpc_field_type type;
+	size_t offset;
+};
+
+struct xmlrpc_schema {
+	const struct xmlrpc_field *fields;
+	int nfields;
+	size_t struct_size;
+};
+
+#define XMLRPC_FIELD(type, member, ftype, name) { name, ftype, offsetof(type, member) }
+#define XMLRPC_SCHEMA(type, fields) { fields, sizeof(fields) / sizeof(fields[0]), sizeof(type) }
+
+/* out has room for max structs, which should be zeroed: members missing
+   from the response are left alone. finish returns the number of structs
+   filled, or -1 with the reason in status (xmlrpc_parse_limit_elements
+   when there are more than max, xmlrpc_parse_fault for a fault response,
+   xmlrpc_parse_bad_data when a member has the wrong type). finish always
+   frees the decoder. */
+struct xmlrpc_decoder;
+
+struct xmlrpc_decoder *xmlrpc_decoder_new(const struct xmlrpc_schema *schema, void *out, int max);
+int xmlrpc_decoder_feed(struct xmlrpc_decoder *dec, const char *buf, int len);
+int xmlrpc_decoder_finish(struct xmlrpc_decoder *dec, xmlrpc_parse_status *status);
+
+int xmlrpc_decode(const char *xml_buffer, const struct xmlrpc_schema *schema,
+		  void *out, int max, xmlrpc_parse_status *status);
+/* Frees the string members of count decoded structs */
+void xmlrpc_decoded_free(const struct xmlrpc_schema *schema, void *out, int count);
+
+#endif /* _XMLRPC_SCHEMA_H_ */
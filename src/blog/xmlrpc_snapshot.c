@@ -0,0 +1,387 @@
+/*
+ * gaim - Blogger (xml-rpc) Protocol Plugin - Flat response snapshots
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <string.h>
+#include <glib.h>
+#include "xmlrpc.h"
+#include "xmlrpc_cache.h"
+
+/*
+ * Layout, all fields are 32 bit words in host byte order:
+ *
+ *   header:  magic, size, response type, root node
+ *   scalar:  type, text length (NO_TEXT if none), text, '\0', padding
+ *   array:   type, count, count item nodes
+ *   struct:  type, count, count (name node, value node) pairs
+ *
+ * Member names are stored as String_T nodes. A child always lives after
+ * its parent, which is checked when reading so a corrupt block can't
+ * send us around in circles.
+ */
+#define SNAPSHOT_MAGIC  0x31535258	/* "XRS1" */
+#define HEADER_WORDS    4
+#define NO_TEXT         0xFFFFFFFF
+
+/*
+ *  PRIVATE CODE
+ */
+
+static guint32 put_u32(GString *b, guint32 v) {
+	guint32 off = b->len;
+
+	g_string_append_len(b, (const gchar*)&v, 4);
+	return off;
+}
+
+static void set_u32(GString *b, guint32 off, guint32 v) {
+	memcpy(b->str + off, &v, 4);
+}
+
+static guint32 put_text(GString *b, xmlrpc_type type, const char *text, int len) {
+	static const char zeros[4] = { 0, 0, 0, 0 };
+	guint32 off = put_u32(b, type);
+
+	if(!text) {
+		put_u32(b, NO_TEXT);
+		return off;
+	}
+	put_u32(b, len);
+	g_string_append_len(b, text, len);
+	g_string_append_len(b, zeros, 4 - (len & 3));
+	return off;
+}
+
+static int put_value(GString *b, const struct xmlrpc_value *value, guint32 *node) {
+	guint32 off, slots, count = 0;
+
+	if(!value) {
+		*node = 0;
+		return 0;
+	}
+
+	switch(value->type) {
+	case Integer_T:
+	case Boolean_T:
+	case String_T:
+	case Double_T:
+	case DateTime_iso8601_T:
+	case Base64_T:
+		*node = put_text(b, value->type, value->data, value->data_len);
+		return 0;
+	case Array_T: {
+		struct xmlrpc_data *d;
+
+		for(d = SAFE_POINTER_2(XMLRPC_ARRAY(value->data), data); d; d = d->next)
+			if(d->value)
+				count++;
+		off = put_u32(b, Array_T);
+		put_u32(b, count);
+		slots = b->len;
+		g_string_set_size(b, b->len + count * 4);
+		for(d = SAFE_POINTER_2(XMLRPC_ARRAY(value->data), data); d; d = d->next) {
+			guint32 child;
+
+			if(!d->value)
+				continue;
+			if(put_value(b, d->value, &child) < 0)
+				return -1;
+			set_u32(b, slots, child);
+			slots += 4;
+		}
+		*node = off;
+		return 0;
+	}
+	case Struct_T: {
+		struct xmlrpc_struct *s;
+
+		for(s = XMLRPC_STRUCT(value->data); s; s = s->next)
+			if(s->member)
+				count++;
+		off = put_u32(b, Struct_T);
+		put_u32(b, count);
+		slots = b->len;
+		g_string_set_size(b, b->len + count * 8);
+		for(s = XMLRPC_STRUCT(value->data); s; s = s->next) {
+			guint32 name = 0, child;
+
+			if(!s->member)
+				continue;
+			if(s->member->name)
+				name = put_text(b, String_T, s->member->name, strlen(s->member->name));
+			if(put_value(b, s->member->value, &child) < 0)
+				return -1;
+			set_u32(b, slots, name);
+			set_u32(b, slots + 4, child);
+			slots += 8;
+		}
+		*node = off;
+		return 0;
+	}
+	case Base64_File_T:
+	default:
+		/* Lives outside the tree, can't be flattened */
+		return -1;
+	}
+}
+
+/* Returns the node at off if its first words fit in the block */
+static const guint32 *node_at(const struct xmlrpc_snapshot *snap, guint32 off, guint64 words) {
+	if(!snap || off < HEADER_WORDS * 4 || (off & 3) ||
+	   (guint64)off + words * 4 > snap->size)
+		return NULL;
+	return (const guint32*)(snap->data + off);
+}
+
+static int is_scalar(guint32 type) {
+	return type == Integer_T || type == Boolean_T || type == String_T ||
+	       type == Double_T || type == DateTime_iso8601_T || type == Base64_T;
+}
+
+static const char *node_text(const struct xmlrpc_snapshot *snap, guint32 off, int *len) {
+	const guint32 *n = node_at(snap, off, 2);
+
+	if(!n || !is_scalar(n[0]) || n[1] == NO_TEXT ||
+	   !node_at(snap, off, 2 + ((guint64)n[1] + 4) / 4) ||
+	   ((const char*)(n + 2))[n[1]] != '\0')
+		return NULL;
+	if(len)
+		*len = n[1];
+	return (const char*)(n + 2);
+}
+
+static struct xmlrpc_value *inflate_value(const struct xmlrpc_snapshot *snap, guint32 off, int *err) {
+	const guint32 *n = node_at(snap, off, 2);
+	struct xmlrpc_value *value;
+	guint32 i;
+
+	if(!n) {
+		*err = 1;
+		return NULL;
+	}
+	value = g_new0(struct xmlrpc_value, 1);
+	value->type = n[0];
+
+	if(is_scalar(n[0])) {
+		const char *text;
+		int len;
+
+		if(n[1] == NO_TEXT)
+			return value;
+		if(!(text = node_text(snap, off, &len))) {
+			*err = 1;
+			return value;
+		}
+		value->data = g_malloc(len + 1);
+		memcpy(value->data, text, len);
+		((char*)value->data)[len] = '\0';
+		value->data_len = len;
+	}
+	else if(n[0] == Array_T) {
+		struct xmlrpc_array *array = g_new0(struct xmlrpc_array, 1);
+		struct xmlrpc_data **tail = &array->data;
+
+		value->data = array;
+		if(!node_at(snap, off, 2 + (guint64)n[1])) {
+			*err = 1;
+			return value;
+		}
+		/* Parser output always has a data element, even when empty */
+		array->data = g_new0(struct xmlrpc_data, 1);
+		for(i = 0; i < n[1] && !*err; i++) {
+			if(n[2+i] <= off) {
+				*err = 1;
+				break;
+			}
+			if(!*tail)
+				*tail = g_new0(struct xmlrpc_data, 1);
+			(*tail)->value = inflate_value(snap, n[2+i], err);
+			tail = &(*tail)->next;
+		}
+	}
+	else if(n[0] == Struct_T) {
+		struct xmlrpc_struct *s = g_new0(struct xmlrpc_struct, 1);
+
+		value->data = s;
+		if(!node_at(snap, off, 2 + (guint64)n[1] * 2)) {
+			*err = 1;
+			return value;
+		}
+		for(i = 0; i < n[1] && !*err; i++) {
+			guint32 name = n[2+i*2], child = n[3+i*2];
+			const char *text;
+			int len;
+
+			if((name && name <= off) || (child && child <= off)) {
+				*err = 1;
+				break;
+			}
+			if(s->member) {
+				s->next = g_new0(struct xmlrpc_struct, 1);
+				s = s->next;
+			}
+			s->member = g_new0(struct xmlrpc_struct_member, 1);
+			if(name) {
+				if(!(text = node_text(snap, name, &len))) {
+					*err = 1;
+					break;
+				}
+				s->member->name = g_strndup(text, len);
+			}
+			if(child)
+				s->member->value = inflate_value(snap, child, err);
+		}
+	}
+	else {
+		/* Keep xmlrpc_free_response() away from data we never set */
+		value->type = String_T;
+		*err = 1;
+	}
+	return value;
+}
+
+/*
+ *  PUBLIC CODE
+ */
+
+unsigned char *xmlrpc_snapshot_new(const struct xmlrpc_response *resp, unsigned int *size) {
+	GString *b;
+	const struct xmlrpc_value *value = NULL;
+	guint32 root;
+
+	if(!resp)
+		return NULL;
+	if(resp->type == valid)
+		value = SAFE_POINTER_2(XMLRPC_PARAM(resp->data), value);
+	else if(resp->type == fault)
+		value = SAFE_POINTER_2(XMLRPC_FAULT(resp->data), value);
+
+	b = g_string_sized_new(256);
+	put_u32(b, SNAPSHOT_MAGIC);
+	put_u32(b, 0);
+	put_u32(b, resp->type);
+	put_u32(b, 0);
+	if(put_value(b, value, &root) < 0) {
+		g_string_free(b, TRUE);
+		return NULL;
+	}
+	set_u32(b, 4, b->len);
+	set_u32(b, 12, root);
+	*size = b->len;
+	return (unsigned char*)g_string_free(b, FALSE);
+}
+
+struct xmlrpc_response *xmlrpc_snapshot_to_response(const struct xmlrpc_snapshot *snap) {
+	const guint32 *h;
+	struct xmlrpc_response *resp;
+	struct xmlrpc_value *value = NULL;
+	int err = 0;
+
+	if(!snap || snap->size < HEADER_WORDS * 4 || ((gsize)snap->data & 3))
+		return NULL;
+	h = (const guint32*)snap->data;
+	if(h[0] != SNAPSHOT_MAGIC || h[1] != snap->size || (h[2] != valid && h[2] != fault))
+		return NULL;
+
+	resp = g_new0(struct xmlrpc_response, 1);
+	resp->type = h[2];
+	if(h[3])
+		value = inflate_value(snap, h[3], &err);
+	if(resp->type == valid) {
+		struct xmlrpc_param *param = g_new0(struct xmlrpc_param, 1);
+		param->value = value;
+		resp->data = param;
+	}
+	else {
+		struct xmlrpc_fault *f = g_new0(struct xmlrpc_fault, 1);
+		f->value = value;
+		resp->data = f;
+	}
+	if(err) {
+		xmlrpc_free_response(resp);
+		return NULL;
+	}
+	return resp;
+}
+
+unsigned int xmlrpc_snapshot_root(const struct xmlrpc_snapshot *snap) {
+	const guint32 *h;
+
+	if(!snap || snap->size < HEADER_WORDS * 4 || ((gsize)snap->data & 3))
+		return 0;
+	h = (const guint32*)snap->data;
+	if(h[0] != SNAPSHOT_MAGIC || h[1] != snap->size)
+		return 0;
+	return h[3];
+}
+
+int xmlrpc_snapshot_type(const struct xmlrpc_snapshot *snap, unsigned int node) {
+	const guint32 *n = node_at(snap, node, 2);
+
+	return n ? (int)n[0] : -1;
+}
+
+const char *xmlrpc_snapshot_text(const struct xmlrpc_snapshot *snap, unsigned int node, int *len) {
+	return node_text(snap, node, len);
+}
+
+int xmlrpc_snapshot_count(const struct xmlrpc_snapshot *snap, unsigned int node) {
+	const guint32 *n = node_at(snap, node, 2);
+
+	if(!n || (n[0] != Array_T && n[0] != Struct_T))
+		return 0;
+	return n[1];
+}
+
+unsigned int xmlrpc_snapshot_item(const struct xmlrpc_snapshot *snap, unsigned int node, int i) {
+	const guint32 *n = node_at(snap, node, 2);
+	guint32 words;
+
+	if(!n || i < 0 || (guint32)i >= n[1])
+		return 0;
+	if(n[0] == Array_T)
+		words = 2 + i + 1;
+	else if(n[0] == Struct_T)
+		words = 2 + i * 2 + 2;
+	else
+		return 0;
+	if(!node_at(snap, node, words) || n[words-1] <= node)
+		return 0;
+	return n[words-1];
+}
+
+const char *xmlrpc_snapshot_member_name(const struct xmlrpc_snapshot *snap, unsigned int node, int i) {
+	const guint32 *n = node_at(snap, node, 2);
+
+	if(!n || n[0] != Struct_T || i < 0 || (guint32)i >= n[1] ||
+	   !node_at(snap, node, 2 + i * 2 + 1) || n[2+i*2] <= node)
+		return NULL;
+	return node_text(snap, n[2+i*2], NULL);
+}
+
+unsigned int xmlrpc_snapshot_member(const struct xmlrpc_snapshot *snap, unsigned int node, const char *name) {
+	int i, count = xmlrpc_snapshot_count(snap, node);
+
+	if(xmlrpc_snapshot_type(snap, node) != Struct_T)
+		return 0;
+	for(i = 0; i < count; i++) {
+		const char *s = xmlrpc_snapshot_member_name(snap, node, i);
+		if(s && strcmp(s, name) == 0)
+			return xmlrpc_snapshot_item(snap, node, i);
+	}
+	return 0;
+}